@@ -1,14 +1,17 @@
 importScripts("./main.js");
 
+// Id of the job currently executed by this worker, used to tag printed lines.
+let currentJob = null;
+
 function print(...args) {
-    postMessage({ print: args });
+    postMessage({ id: currentJob, print: args });
 }
 
 var Module = {
     print,
     printErr: print,
     setStatus: function (...msg) {
-        postMessage({ status: msg });
+        postMessage({ id: currentJob, status: msg });
     },
     totalDependencies: 0,
     monitorRunDependencies(left) {
@@ -16,19 +19,33 @@ var Module = {
         Module.setStatus(left ? 'Preparing... (' + (this.totalDependencies - left) + '/' + this.totalDependencies + ')' : 'All downloads complete.');
     },
     locateFile: (path) => `./${path}`, // Ensures .wasm resolves
-    onExit(code) {
-        postMessage({ finished: true, exitCode: code });
-        self.close();
-    },
 };
 self.onerror = (event) => {
     // TODO: do not warn on ok events like simulating an infinite loop or exitStatus
     Module.setStatus('Exception thrown, see JavaScript console');
 };
 
-onmessage = (e) => {
-    const args = e.data.map(a => a.toString()) || [];
+// The module is instantiated once and reused by all jobs sent to this worker.
+const modulePromise = createModule(Module);
+
+// Copies structured result of the last solveArgs call out of the wasm heap.
+function readResult(mod) {
+    const stats = new Float64Array(mod.HEAPF64.buffer, mod._resultStats(), 5);
+    const [exitCode, answer, sequencesNum, seconds, profileLength] = stats;
+    const worstProfile = Array.from(new Uint32Array(mod.HEAPU32.buffer, mod._resultProfile(), profileLength));
+    return { exitCode, answer, sequencesNum, seconds, worstProfile };
+}
 
-    console.log("Worker received args:", args);
-    createModule(Object.assign({ arguments: args }, Module));
+onmessage = async (e) => {
+    const { id, args, version } = e.data;
+    const mod = await modulePromise;
+    if (version) {
+        postMessage({ id, version: mod.ccall('solverVersion', 'string', [], []) });
+        return;
+    }
+    currentJob = id;
+    const line = (args || []).map(a => a.toString()).join(' ');
+    const exitCode = mod.ccall('solveArgs', 'number', ['string'], [line]);
+    postMessage({ id, finished: true, exitCode, result: readResult(mod) });
+    currentJob = null;
 };
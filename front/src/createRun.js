@@ -13,6 +13,9 @@ export function createRun(id, args, { throttleMs = 100 } = {}) {
         output: [],
         abortController: new AbortController(),
         exitCode: null,
+        result: null, // structured outcome: answer, worstProfile, sequencesNum, seconds
+        cached: false, // whether the outcome was taken from cache
+        error: null, // message of the error which stopped the run
     });
 
     // Non-reactive internals
@@ -39,16 +42,36 @@ export function createRun(id, args, { throttleMs = 100 } = {}) {
         run.reportedStatus = status.join(' ');
     }
 
-    async function start() {
+    // Starts the run, or replays its outcome stored in cache (see resultCache.js) if given.
+    async function start(cache = null) {
         if (run._status !== 'queued') return;
         run._status = 'running';
         try {
-            run.exitCode = await main(toRaw(run.args), print, run.abortController.signal, setStatus);
-            if (run._status === 'running') run._status = 'completed';
+            const stored = await cache?.get(toRaw(run.args));
+            if (run._status !== 'running') return;
+            if (stored) {
+                run.output.push(...stored.output);
+                run.exitCode = stored.exitCode;
+                run.result = stored.result;
+                run.cached = true;
+                run._status = 'completed';
+                return;
+            }
+            const { exitCode, result } = await main(toRaw(run.args), print, run.abortController.signal, setStatus);
+            run.exitCode = exitCode;
+            run.result = result ?? null;
+            if (run._status === 'running') {
+                run._status = 'completed';
+                flush();
+                if (cache && exitCode !== -1) {
+                    cache.put(toRaw(run.args), { exitCode, result: toRaw(run.result), output: [...toRaw(run.output)] });
+                }
+            }
         } catch (err) {
             if (run._status !== 'aborted') {
                 run._status = 'error';
-                print('Error:', err?.message ?? String(err));
+                run.error = err?.message ?? String(err);
+                print('Error:', run.error);
             }
         } finally {
             flush();
@@ -77,6 +100,7 @@ export function createRun(id, args, { throttleMs = 100 } = {}) {
             status: status.value,
             answer: answer.value,
             exitCode: run.exitCode,
+            result: toRaw(run.result),
             output: toRaw(run.output),
         };
     }
@@ -98,10 +122,20 @@ export function createRun(id, args, { throttleMs = 100 } = {}) {
         }
     });
 
+    // Mirrors how the solver prints answers: rounded to 4 decimal places,
+    // at most 6 significant digits.
+    function formatAnswer(x) {
+        return String(Number(Number(x.toFixed(4)).toPrecision(6)));
+    }
+
     const statusText = computed(() => {
         if (status.value === "completed" && run.output.length === 1) {
             return `answer ${run.output[0]}`;
         }
+        if (status.value === "completed" && run.result) {
+            const cached = run.cached ? ', cached' : '';
+            return `answer ${formatAnswer(run.result.answer)} (${run.result.sequencesNum} seqs, ${run.result.seconds.toFixed(3)}s${cached})`;
+        }
         return status.value;
     });
     const ANSWER_MAP = {
@@ -116,6 +150,7 @@ export function createRun(id, args, { throttleMs = 100 } = {}) {
         if (status.value === "completed") {
             if (run.output.length === 1)
                 return `${run.output[0]}`;
+            else if (run.result) return formatAnswer(run.result.answer);
             else if (run.output.length > 1) return '#';
             else return '-';
         }
@@ -0,0 +1,59 @@
+import { solverVersion } from './solver.js';
+
+// Outcomes of runs kept in IndexedDB between sessions. The solver is deterministic, so a run
+// is keyed by a hash of the solver build version with its normalized arguments. Failures to
+// use the database are silent, runs are then solved as usual.
+const DB_NAME = 'cycle-mechanisms';
+const STORE_NAME = 'results';
+let dbPromise = null;
+
+function openDb() {
+    dbPromise ??= new Promise((resolve, reject) => {
+        const request = indexedDB.open(DB_NAME, 1);
+        request.onupgradeneeded = () => request.result.createObjectStore(STORE_NAME);
+        request.onsuccess = () => resolve(request.result);
+        request.onerror = () => reject(request.error);
+    });
+    return dbPromise;
+}
+
+// Arguments separated by single spaces, as the solver splits them.
+function normalizeArgs(args) {
+    return args.map(String).join(' ').split(/\s+/).filter(Boolean).join(' ');
+}
+
+async function cacheKey(args) {
+    const key = `${await solverVersion()} | ${normalizeArgs(args)}`;
+    // subtle crypto is available only in secure contexts
+    if (!crypto.subtle) return key;
+    const digest = await crypto.subtle.digest('SHA-256', new TextEncoder().encode(key));
+    return Array.from(new Uint8Array(digest), (b) => b.toString(16).padStart(2, '0')).join('');
+}
+
+async function transact(mode, action) {
+    const db = await openDb();
+    return new Promise((resolve, reject) => {
+        const request = action(db.transaction(STORE_NAME, mode).objectStore(STORE_NAME));
+        request.onsuccess = () => resolve(request.result);
+        request.onerror = () => reject(request.error);
+    });
+}
+
+// Stored { exitCode, result, output } of run with given args, undefined if there is none.
+export async function get(args) {
+    try {
+        const key = await cacheKey(args);
+        return await transact('readonly', (store) => store.get(key));
+    } catch {
+        return undefined;
+    }
+}
+
+export async function put(args, outcome) {
+    try {
+        const key = await cacheKey(args);
+        await transact('readwrite', (store) => store.put(outcome, key));
+    } catch {
+        // not cached
+    }
+}
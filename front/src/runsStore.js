@@ -1,28 +1,88 @@
 import { defineStore } from 'pinia';
+import { toRaw } from 'vue';
 import { createRun } from './createRun';
 import { createOverview } from './createOverview';
+import * as resultCache from './resultCache';
+import { main } from './solver.js';
+import { configToArgs } from './configToArgs.js';
+
+// Memory budgeted for a worker, whose wasm heap grows with its run (GiB).
+const WORKER_MEMORY_GIB = 0.25;
+
+// Workers are CPU bound, so there are as many of them as cores, but fewer on devices reporting
+// little memory (deviceMemory, in GiB, is reported only by some browsers), half of which is
+// left to the rest of the system.
+function defaultConcurrency() {
+    const cores = navigator.hardwareConcurrency || 4;
+    const memory = navigator.deviceMemory;
+    const byMemory = memory ? Math.floor(memory / 2 / WORKER_MEMORY_GIB) : cores;
+    return Math.max(1, Math.min(cores, byMemory));
+}
+
+// Consecutive completed runs after which a concurrency limit lowered on memory errors grows
+// by one. Each further memory error at the same limit doubles the number.
+const SUCCESSES_TO_GROW = 4;
+
+// Errors of workers running out of memory: the wasm heap failing to grow aborts the worker,
+// a failed allocation of the solver ends the run with std::bad_alloc.
+const MEMORY_ERROR = /memory|\bOOM\b|bad_alloc|allocation failed/i;
+
+function ranOutOfMemory(run) {
+    if (run.status === 'error') return MEMORY_ERROR.test(run.error ?? '');
+    return run.status === 'completed' && run.exitCode !== 0 && MEMORY_ERROR.test(run.output.at(-1) ?? '');
+}
+
+// Estimated cost of a run of config (see configToArgs): its number of profiles, counted by
+// complexity mode (C) of the solver on the same profiles, times the work per profile, which
+// evaluates a lottery (linear in agents) once, or once per vertex when checking
+// strategyproofness. Runs over their limit of profiles stop at once. Infinity if unknown.
+async function estimateCost(config) {
+    if (config.task === 'C') return 0;
+    const args = configToArgs({ ...config, task: 'C', verbosity: 'V1', calculationsLimit: -1 });
+    const lines = [];
+    const { exitCode } = await main(args, (line) => lines.push(String(line)));
+    const profiles = Number(lines[0]);
+    if (exitCode !== 0 || !Number.isFinite(profiles)) return Infinity;
+    const limit = Number(config.calculationsLimit);
+    if (limit > 0 && profiles > limit) return 0;
+    return profiles * Number(config.numAgents) * (config.task === 'D' ? Number(config.numVertices) : 1);
+}
 
 // Pinia store managing a list of runs created by the per-run composable.
 export const useRunsStore = defineStore('runs', {
     state: () => ({
         runs: new Map(), // Map<id, run>
         nextRunId: 0,
-        queue: [], // FIFO queue of run ids waiting to start
+        queue: [], // ids of runs waiting to start, in order they were added
+        configs: new Map(), // Map<id, config> of queued runs, see configToArgs
+        costs: new Map(), // Map<id, estimated cost> of queued runs, see estimateCost
+        estimatingId: null, // id of the run being estimated, its worker counts as active
+        // 'shortest' first fills in cells of batches quickly, 'longest' first finishes them sooner
+        order: 'shortest',
         activeCount: 0,
-        concurrencyLimit: 16,
+        concurrencyLimit: defaultConcurrency(),
+        // concurrencyLimit lowered on memory errors climbs back to it as runs succeed
+        maxConcurrency: defaultConcurrency(),
+        failedLimit: null, // concurrencyLimit at the last memory error
+        successesToGrow: SUCCESSES_TO_GROW,
+        successStreak: 0, // runs completed since the limit last changed or a run failed
+        // opt-in reuse of outcomes of identical runs, remembered between sessions
+        cacheResults: localStorage.getItem('cacheResults') === 'true',
     }),
     getters: {
         getRun: (state) => (id) => state.runs.get(id),
         runsArray: (state) => Array.from(state.runs.values()),
     },
     actions: {
-        addRun(args) {
+        // Adds run of config (see configToArgs) to the queue.
+        addRun(config) {
             const id = this.nextRunId++;
-            const run = createRun(id, args);
+            const run = createRun(id, configToArgs(config));
             this.runs.set(id, run);
-            // Enqueue and attempt to start if under the limit
+            this.configs.set(id, config);
             this.queue.push(id);
-            this.maybeStartNext();
+            // runs added together (as cells of a batch) are all queued before any is picked
+            queueMicrotask(() => this.maybeStartNext());
             return id;
         },
         addOverview(...params) {
@@ -31,21 +91,80 @@ export const useRunsStore = defineStore('runs', {
             this.runs.set(id, overview);
             return id;
         },
+        setCacheResults(enabled) {
+            this.cacheResults = enabled;
+            localStorage.setItem('cacheResults', String(enabled));
+        },
+        // Estimates the oldest queued run which is not estimated yet, on a worker counted by
+        // concurrencyLimit. Returns whether there was such a run.
+        startEstimate() {
+            const id = this.queue.find((qid) => !this.costs.has(qid));
+            if (id === undefined) return false;
+            const config = structuredClone(toRaw(this.configs.get(id)));
+            this.estimatingId = id;
+            this.activeCount++;
+            estimateCost(config).catch(() => Infinity).then((cost) => {
+                this.estimatingId = null;
+                --this.activeCount;
+                // the run might have started or been removed meanwhile
+                if (this.queue.includes(id)) this.costs.set(id, cost);
+                this.maybeStartNext();
+            });
+            return true;
+        },
+        // Next queued run to start: the oldest one while all queued runs fit in free workers or
+        // none of them is estimated yet, otherwise the cheapest (or the most expensive) one of
+        // those estimated.
+        pickNext() {
+            const estimated = this.queue.filter((id) => this.costs.has(id));
+            if (this.queue.length <= this.concurrencyLimit - this.activeCount || !estimated.length) return this.queue[0];
+            const sign = this.order === 'longest' ? -1 : 1;
+            return estimated.reduce((best, id) =>
+                sign * (this.costs.get(id) - this.costs.get(best)) < 0 ? id : best);
+        },
         maybeStartNext() {
+            // runs might have been removed or aborted while queued
+            this.queue = this.queue.filter((id) => this.getRun(id)?.status === 'queued');
             while (this.activeCount < this.concurrencyLimit && this.queue.length > 0) {
-                const nextId = this.queue.shift();
+                // Order matters while more runs wait than there are free workers. Runs are
+                // estimated one at a time; estimates are cheap, so they take also the only
+                // free worker, which is otherwise never free on small devices.
+                const free = this.concurrencyLimit - this.activeCount;
+                if (this.queue.length > free && this.estimatingId === null && this.startEstimate()) continue;
+                const nextId = this.pickNext();
+                this.queue = this.queue.filter((id) => id !== nextId);
+                this.costs.delete(nextId);
+                this.configs.delete(nextId);
                 const run = this.getRun(nextId);
-                if (!run) continue; // It might have been removed
-                if (run.status !== 'queued') continue;
                 this.activeCount++;
                 // Start and when finished, decrement and continue
-                run.start().finally(() => {
+                run.start(this.cacheResults ? resultCache : null).finally(() => {
                     --this.activeCount;
+                    this.adjustConcurrency(run);
                     this.maybeStartNext();
                 });
             }
         },
+        // A worker running out of memory means too many of them run at once, so the limit is
+        // lowered. It grows back only after a streak of completed runs, longer each time the
+        // same limit fails again, so that sustained memory pressure does not keep causing errors.
+        adjustConcurrency(run) {
+            if (ranOutOfMemory(run)) {
+                if (this.failedLimit === this.concurrencyLimit) this.successesToGrow *= 2;
+                this.failedLimit = this.concurrencyLimit;
+                this.concurrencyLimit = Math.max(1, this.concurrencyLimit - 1);
+                this.successStreak = 0;
+            } else if (run.status === 'error' || (run.status === 'completed' && run.exitCode !== 0)) {
+                this.successStreak = 0;
+            } else if (run.status === 'completed' && this.concurrencyLimit < this.maxConcurrency
+                && ++this.successStreak >= this.successesToGrow) {
+                this.concurrencyLimit++;
+                this.successStreak = 0;
+            }
+        },
         removeFromQueue(id) {
+            this.costs.delete(id);
+            this.configs.delete(id);
             if (!this.queue.length) return;
             this.queue = this.queue.filter((qid) => qid !== id);
         },
@@ -81,6 +200,8 @@ export const useRunsStore = defineStore('runs', {
                 run.dispose?.();
             }
             this.queue = [];
+            this.configs = new Map();
+            this.costs = new Map();
             this.runs = new Map();
         },
     }
@@ -1,10 +1,51 @@
+// Workers keep their wasm module instantiated between runs, so idle ones are
+// pooled and reused instead of being created for every run.
+const idleWorkers = [];
+let nextJobId = 0;
+
+function acquireWorker() {
+    return idleWorkers.pop() ?? new Worker("wasm/worker.js");
+}
+
+function releaseWorker(worker) {
+    worker.onmessage = null;
+    worker.onerror = null;
+    idleWorkers.push(worker);
+}
+
+let versionPromise = null;
+
+// Version of the solver build, resolved once by any worker.
+export function solverVersion() {
+    versionPromise ??= new Promise((resolve, reject) => {
+        const worker = acquireWorker();
+        const id = nextJobId++;
+        worker.onmessage = (e) => {
+            if (e.data.id !== id || e.data.version === undefined) return;
+            releaseWorker(worker);
+            resolve(e.data.version);
+        };
+        worker.onerror = (err) => {
+            worker.terminate();
+            versionPromise = null;
+            reject(err);
+        };
+        worker.postMessage({ id, version: true });
+    });
+    return versionPromise;
+}
+
+// Runs solver with given args, resolves to { exitCode, result } where result is
+// structured outcome reported by the module (undefined when run was aborted).
 export function main(args, print, abortSignal, setStatus) {
     return new Promise((resolve, reject) => {
-        const worker = new Worker("wasm/worker.js");
+        const worker = acquireWorker();
+        const id = nextJobId++;
+        let done = false;
 
-        // send args to main()
-        worker.postMessage(args);
         worker.onmessage = (e) => {
+            // messages sent while module loads are not tagged with job id
+            if (done || (e.data.id !== id && e.data.id !== null)) return;
             if (e.data.print !== undefined) {
                 print(e.data.print);
             }
@@ -12,21 +53,29 @@ export function main(args, print, abortSignal, setStatus) {
                 setStatus(e.data.status);
             }
             if (e.data.finished !== undefined) {
-                worker.terminate();
-                resolve(e.data.exitCode ?? -1);
+                done = true;
+                releaseWorker(worker);
+                resolve({ exitCode: e.data.exitCode ?? -1, result: e.data.result });
             }
         };
 
         worker.onerror = (err) => {
+            done = true;
             worker.terminate();
             reject(err);
         };
 
         if (abortSignal) {
             abortSignal.addEventListener('abort', () => {
+                if (done) return;
+                done = true;
+                // wasm cannot be interrupted, so the busy worker is discarded
                 worker.terminate();
-                resolve(-1);
+                resolve({ exitCode: -1 });
             });
         }
+
+        // send args to solver
+        worker.postMessage({ id, args });
     });
 }
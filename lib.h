@@ -9,11 +9,30 @@
 #include <limits>
 #include <algorithm>
 #include <iterator>
+#include <fstream>
+#include <sstream>
 #include <string>
 #include <memory>
+#include <set>
+#include <optional>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <array>
 // #include <generator>
 #include "npy.hpp"
 #include "generator.hpp"
+#if defined(STAGE_STATS) && defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 #define EXPR(b) { return b; }
 
@@ -22,7 +41,6 @@ using std::size_t;
 using std::vector;
 using std::min, std::max;
 using std::multiplies;
-using std::cout, std::cerr;
 using std::function;
 using std::plus;
 using std::pow, std::round;
@@ -39,20 +57,335 @@ using std::string;
 using std::unique_ptr;
 using std::move;
 
+// Streams results are printed to. They write to std::cout and std::cerr, but every thread
+// has its own, so that jobs run concurrently (server mode of main) redirect them and set
+// their formatting independently.
+inline thread_local std::ostream cout(std::cout.rdbuf()), cerr(std::cerr.rdbuf());
+
+// Heap allocations made by the thread, counted by operator new of the program if it
+// replaces it (as main does). A plain counter per thread keeps allocations cheap.
+inline thread_local size_t heapAllocations = 0;
+
 using real=double;
 template<typename T>
 using l=vector<T>;
-using lottery=function<l<real>(const l<size_t>&)>;
 constexpr real EPS = 1e-6;
 
+// Thread-local stock of vectors for temporaries of hot loops: lottery results, agent costs
+// and deviated profiles take storage from it and give it back once consumed, so that
+// evaluating a profile does not allocate in steady state.
+template<typename T>
+class VectorPool {
+    static constexpr size_t capacity = 16;
+    static l<l<T>> &stock() {
+        thread_local l<l<T>> res = [] {
+            l<l<T>> s;
+            s.reserve(capacity);
+            return s;
+        }();
+        return res;
+    }
+public:
+    // empty vector, reusing storage given back earlier if there is any
+    static l<T> take() {
+        l<l<T>> &s = stock();
+        if (s.empty()) return {};
+        l<T> res = std::move(s.back());
+        s.pop_back();
+        res.clear();
+        return res;
+    }
+    static void give(l<T> &&v) {
+        l<l<T>> &s = stock();
+        if (v.capacity() && s.size() < capacity) s.push_back(std::move(v));
+    }
+};
+
+// Forwards output to target in whole lines, under a lock shared by all threads writing to
+// it, so that lines printed by concurrent threads are not interleaved.
+class LineForwardBuf : public std::streambuf {
+    std::streambuf *target;
+    std::mutex &mutex;
+    string pending;
+    void forward(size_t size) {
+        std::lock_guard lock(mutex);
+        target->sputn(pending.data(), size);
+        pending.erase(0, size);
+    }
+protected:
+    int overflow(int c) override {
+        if (c == EOF) return 0;
+        pending += char(c);
+        if (c == '\n') forward(pending.size());
+        return c;
+    }
+    std::streamsize xsputn(const char *s, std::streamsize n) override {
+        pending.append(s, n);
+        if (size_t end = pending.rfind('\n'); end != string::npos) forward(end + 1);
+        return n;
+    }
+    int sync() override {
+        if (!pending.empty()) forward(pending.size());
+        std::lock_guard lock(mutex);
+        return target->pubsync();
+    }
+public:
+    LineForwardBuf(std::streambuf *target, std::mutex &mutex) : target(target), mutex(mutex) {}
+    ~LineForwardBuf() { sync(); }
+};
+
+// Runs worker(t) for t < threads, t = 0 on the calling thread, and waits for all of them.
+// Meanwhile every one of them prints to cout and cerr of the caller (whole lines, in its
+// formatting), which may be redirected (as for jobs of server mode of main), and heap
+// allocations of the helper threads are added to those of the caller.
+template<typename F>
+void parallel(size_t threads, F worker) {
+    if (threads <= 1) return worker(0);
+    std::mutex mutex;
+    size_t helperAllocations = 0;
+    std::streambuf *out = cout.rdbuf(), *err = cerr.rdbuf();
+    const std::ios::fmtflags outFlags = cout.flags(), errFlags = cerr.flags();
+    const std::streamsize outPrecision = cout.precision(), errPrecision = cerr.precision();
+    auto run = [&](size_t t) {
+        const size_t startAllocations = heapAllocations;
+        LineForwardBuf outBuf(out, mutex), errBuf(err, mutex);
+        // buffers of the thread are restored also when worker throws
+        struct Restore {
+            std::streambuf *out, *err;
+            ~Restore() {
+                cout.rdbuf(out);
+                cerr.rdbuf(err);
+            }
+        } restore{cout.rdbuf(&outBuf), cerr.rdbuf(&errBuf)};
+        struct CountAllocations {
+            size_t t, start, &total;
+            std::mutex &mutex;
+            ~CountAllocations() {
+                if (!t) return;
+                std::lock_guard lock(mutex);
+                total += heapAllocations - start;
+            }
+        } countAllocations{t, startAllocations, helperAllocations, mutex};
+        cout.flags(outFlags);
+        cout.precision(outPrecision);
+        cerr.flags(errFlags);
+        cerr.precision(errPrecision);
+        worker(t);
+    };
+    {
+        l<std::jthread> pool;
+        for (size_t t = 1; t < threads; ++t) pool.emplace_back(run, t);
+        run(0);
+    }
+    heapAllocations += helperAllocations;
+}
+
+// Stage instrumentation attributes time of check, score and rdRatio to stages of their loops,
+// together with hardware counters where Linux perf events are available. It is compiled in
+// with -DSTAGE_STATS (make main_stages); otherwise STAGE expands to nothing. Time of nested
+// stages is not charged to the enclosing one; stages are tracked per thread.
+#ifdef STAGE_STATS
+enum class Stage { generation, filtering, lottery, cost, deviations, output, other };
+constexpr size_t stagesNum = size_t(Stage::other) + 1;
+constexpr const char *stageNames[stagesNum] = {"generation", "filtering", "lottery", "cost", "deviations", "output", "other"};
+constexpr size_t stageCountersNum = 4;
+constexpr const char *stageCounterNames[stageCountersNum] = {"cycles", "instructions", "cache misses", "branch misses"};
+
+class StageStats {
+    // nanoseconds followed by hardware counters
+    using Reading = std::array<uint64_t, 1 + stageCountersNum>;
+    std::array<Reading, stagesNum> totals{};
+    std::array<uint64_t, stagesNum> entries{};
+    Stage current = Stage::other;
+    Reading last{};
+    int groupFd = -1;
+    bool countersAvailable = false;
+
+    void openCounters() {
+#ifdef __linux__
+        const uint64_t configs[stageCountersNum] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        for (size_t i = 0; i < stageCountersNum; ++i) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            attr.disabled = groupFd == -1;
+            int fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0));
+            if (fd == -1) {
+                if (groupFd != -1) close(groupFd);
+                groupFd = -1;
+                return;
+            }
+            if (groupFd == -1) groupFd = fd;
+        }
+        ioctl(groupFd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(groupFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        countersAvailable = true;
+#endif
+    }
+    Reading read() const {
+        Reading res{};
+        res[0] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#ifdef __linux__
+        if (countersAvailable) {
+            uint64_t values[1 + stageCountersNum];
+            if (::read(groupFd, values, sizeof(values)) == ssize_t(sizeof(values)))
+                std::copy(values + 1, values + 1 + stageCountersNum, res.begin() + 1);
+        }
+#endif
+        return res;
+    }
+    void charge(const Reading &now) {
+        for (size_t i = 0; i < now.size(); ++i) totals[size_t(current)][i] += now[i] - last[i];
+        last = now;
+    }
+public:
+    StageStats() { openCounters(); }
+    ~StageStats() {
+#ifdef __linux__
+        if (groupFd != -1) close(groupFd);
+#endif
+    }
+    static StageStats &local() {
+        thread_local StageStats res;
+        return res;
+    }
+    // starts attributing to given stage, returns the stage to get back to
+    Stage enter(Stage stage) {
+        charge(read());
+        ++entries[size_t(stage)];
+        return std::exchange(current, stage);
+    }
+    void leave(Stage previous) {
+        charge(read());
+        current = previous;
+    }
+    void reset() {
+        totals = {};
+        entries = {};
+        last = read();
+    }
+    void print(std::ostream &os) const {
+        Reading all{};
+        for (const Reading &t : totals)
+            for (size_t i = 0; i < all.size(); ++i) all[i] += t[i];
+        os << "stage\tentries\tseconds\tshare";
+        if (countersAvailable) for (const char *name : stageCounterNames) os << '\t' << name;
+        os << '\n';
+        for (size_t s = 0; s < stagesNum; ++s) {
+            if (!entries[s] && !totals[s][0]) continue;
+            os << stageNames[s] << '\t' << entries[s] << '\t' << setprecision(3) << scientific << totals[s][0] * 1e-9
+                << '\t' << std::fixed << setprecision(3) << (all[0] ? real(totals[s][0]) / all[0] : 0.);
+            if (countersAvailable) for (size_t i = 1; i < all.size(); ++i) os << '\t' << totals[s][i];
+            os << std::defaultfloat << '\n';
+        }
+        if (!countersAvailable) os << "(hardware counters unavailable)\n";
+    }
+};
+
+class StageScope {
+    Stage previous;
+public:
+    StageScope(Stage stage) : previous(StageStats::local().enter(stage)) {}
+    StageScope(const StageScope &) = delete;
+    ~StageScope() { StageStats::local().leave(previous); }
+};
+
+#define STAGE_CONCAT_(a, b) a##b
+#define STAGE_CONCAT(a, b) STAGE_CONCAT_(a, b)
+// attributes the rest of the enclosing block to given stage
+#define STAGE(name) StageScope STAGE_CONCAT(stageScope, __LINE__)(Stage::name)
+// starts attribution for a task, whose remaining time is attributed to given stage
+#define STAGE_TASK(name) StageStats::local().reset(); STAGE(name)
+#define STAGE_PRINT(os) StageStats::local().print(os)
+#else
+#define STAGE(name)
+#define STAGE_TASK(name)
+#define STAGE_PRINT(os) ((void)0)
+#endif
+
 bool nzero(real x) EXPR(x > EPS || x < -EPS)
 
+// Exact fraction used to certify results computed with reals.
+// Throws std::overflow_error instead of silently losing precision.
+class Rational {
+    std::int64_t num, den;
+    using wide = __int128;
+    static std::int64_t narrow(wide x) {
+        if (x > numeric_limits<std::int64_t>::max() || x < numeric_limits<std::int64_t>::min())
+            throw std::overflow_error("rational overflow");
+        return std::int64_t(x);
+    }
+    static Rational make(wide n, wide d) {
+        if (d == 0) throw std::domain_error("rational division by zero");
+        if (d < 0) n = -n, d = -d;
+        wide a = n < 0 ? -n : n, b = d;
+        while (b != 0) a = std::exchange(b, a % b);
+        Rational res;
+        res.num = narrow(n / a);
+        res.den = narrow(d / a);
+        return res;
+    }
+public:
+    Rational(std::int64_t num = 0) : num(num), den(1) {}
+    Rational(std::int64_t num, std::int64_t den) : Rational(make(num, den)) {}
+    // parses decimal notation, e.g. "0.25", "-3", "1e-2"
+    static Rational parse(const string &s) {
+        size_t pos = s.starts_with('-') || s.starts_with('+') ? 1 : 0;
+        Rational res = 0, scale = 1;
+        bool fraction = false, digits = false;
+        for (; pos < s.size() && s[pos] != 'e' && s[pos] != 'E'; ++pos) {
+            if (s[pos] == '.' && !fraction) fraction = true;
+            else if (s[pos] >= '0' && s[pos] <= '9') {
+                res = res * 10 + (s[pos] - '0');
+                if (fraction) scale *= 10;
+                digits = true;
+            }
+            else throw std::invalid_argument("not a decimal number: " + s);
+        }
+        if (!digits) throw std::invalid_argument("not a decimal number: " + s);
+        if (pos < s.size()) {
+            for (int e = std::stoi(s.substr(pos + 1)); e != 0; e += e > 0 ? -1 : 1) {
+                if (e > 0) res *= 10;
+                else scale *= 10;
+            }
+        }
+        res /= scale;
+        return s.starts_with('-') ? -res : res;
+    }
+    explicit operator real() const EXPR(real(num) / real(den))
+    friend Rational operator-(const Rational &a) EXPR(make(-wide(a.num), a.den))
+    friend Rational operator+(const Rational &a, const Rational &b) EXPR(make(wide(a.num) * b.den + wide(b.num) * a.den, wide(a.den) * b.den))
+    friend Rational operator-(const Rational &a, const Rational &b) EXPR(make(wide(a.num) * b.den - wide(b.num) * a.den, wide(a.den) * b.den))
+    friend Rational operator*(const Rational &a, const Rational &b) EXPR(make(wide(a.num) * b.num, wide(a.den) * b.den))
+    friend Rational operator/(const Rational &a, const Rational &b) EXPR(make(wide(a.num) * b.den, wide(a.den) * b.num))
+    Rational &operator+=(const Rational &b) EXPR(*this = *this + b)
+    Rational &operator-=(const Rational &b) EXPR(*this = *this - b)
+    Rational &operator*=(const Rational &b) EXPR(*this = *this * b)
+    Rational &operator/=(const Rational &b) EXPR(*this = *this / b)
+    friend bool operator==(const Rational &a, const Rational &b) = default;
+    friend auto operator<=>(const Rational &a, const Rational &b) EXPR(wide(a.num) * b.den <=> wide(b.num) * a.den)
+    friend std::ostream &operator<<(std::ostream &os, const Rational &a) {
+        os << a.num;
+        if (a.den != 1) os << '/' << a.den;
+        return os;
+    }
+};
+
 real circleDistance(real a, real b) {
     return min(b - a, 1 + a - b);
 }
 
-real circleRank(real x) {
-    return circleDistance(0, x);
+template<typename T = real>
+T uniformRank(T) EXPR(1)
+
+template<typename T = real>
+T circleRank(T x) {
+    return min(x, 1 - x);
 }
 
 auto powerRank(real e) {
@@ -120,218 +453,55 @@ void printM(const char *sep = "\t", args... Args) {
     ((cout << Args << sep), ...);
 }
 
-template<typename F>
-lottery distantBasedLottery(size_t size, const F &ranks) {
-    vector<real> weights = vector<real>(size+1);
-
-    // precalculating weight
-    real prefixSum = 0;
-    for (size_t i = 0; i < size; ++i) {
-        weights[i+1] = prefixSum += ranks((i + 0.5f) / size);
-    }
-    auto rankOfRange = [weights](size_t b, size_t a = 0) EXPR(weights[b] - weights[a]);
-    return [rankOfRange, size, prefixSum](const l<size_t> &as) {
-        const size_t agentsNum = as.size();
-        const size_t dis = agentsNum / 2;
-        l<real> res{};
-        res.reserve(agentsNum);
-        for (size_t i = 0; i < agentsNum; ++i) {
-            real probability = 0;
-            const size_t scoredRangeStart = (i + dis) % agentsNum;
-            const size_t scoredRangeEnd = (scoredRangeStart + 1) % agentsNum;
-            for (size_t j = 0; j < agentsNum; ++j) {
-                if (scoredRangeStart < j)
-                    probability += rankOfRange(as[j] - as[scoredRangeStart], as[j] - as[scoredRangeEnd]);
-                else if (scoredRangeEnd <= j)
-                    probability += rankOfRange(size + as[j] - as[scoredRangeStart], as[j] - as[scoredRangeEnd]);
-                else
-                    probability += rankOfRange(as[scoredRangeEnd] - as[j], as[scoredRangeStart] - as[j]);
-            }
-            res.push_back(probability / prefixSum / agentsNum);
-        }
-        return res;
-    };
-}
-
-template<rn::input_range R>
-vector<rn::range_value_t<R>> toVec(R &&r) {
-    vector<rn::range_value_t<R>> res;
-    if constexpr(rn::sized_range<decltype(r)>) res.reserve(rn::size(r));
-    rn::copy(r, back_inserter(res));
-    return res;
-}
-
-template<bool normalize = true>
-lottery gapBasedLottery(size_t size, l<real> weights) {
-    return [size, weights](const l<size_t> &as) {
-        const size_t agentsNum = as.size();
-        l<real> agent_pos(agentsNum * 2);
-        for (size_t i = 0; i < agentsNum; ++i) {
-            agent_pos[i] = real(as[i]) / size;
-            agent_pos[i + agentsNum] = real(as[i]) / size + 1;
-        }
-        l<real> res(agentsNum);
-        for (size_t i = 0; i < agentsNum; ++i) {
-            real s = 0;
-            for (size_t j = 0; j < weights.size(); ++j) {
-            real sum = 0;
-            for (size_t k = i; k < i + agentsNum; ++k) {
-                size_t idx1 = k % agentsNum;
-                size_t idx2 = (k + 1) % agentsNum;
-                sum += weights[j] * (agent_pos[idx2] - agent_pos[idx1]);
-            }
-            s += sum;
-            }
-            res[i] = s;
-        }
-        if (normalize) {
-            real s = sum(res);
-            for (real &el : res) el /= s;
-        }
-        return res;
-    };
-}
-
-template<bool normalize = true>
-lottery oppositionBasedLottery(size_t size, function<real(real)> weights) {
-    return [size, weights](const l<size_t> &as) {
-        const size_t agentsNum = as.size();
-        const size_t dis = agentsNum / 2;
-        l<real> res(agentsNum);
-        for (size_t i = 0; i < agentsNum; ++i) {
-            size_t idx1 = (i + dis) % agentsNum;
-            size_t idx2 = (i + dis + 1) % agentsNum;
-            real diff = (real(as[idx2]) - as[idx1]) / size;
-            if (i + dis == agentsNum - 1)
-            diff += 1;
-            res[i] = weights(diff);
-        }
-        if (normalize) {
-            real s = sum(res);
-            for (real &el : res) el /= s;
-        }
-        return res;
-    };
-}
-
-auto customLottery(size_t size, const string &path, size_t opt) {
-    std::vector<unsigned long> shape {};
-    std::vector<real> data;
-
-    npy::LoadArrayFromNumpy(path, shape, data);
-    for (auto dim : shape | drop(1) | reverse | drop(1)) {
-        if (dim != size) exit(2);
-    }
-    return [size, shape, data, opt](const l<size_t> &as) {
-        const size_t agentsNum = as.size();
-        if (agentsNum + 1 != shape.size()) exit(3);
-        size_t start = 0;
-        if (opt >= 1) {
-            for (auto el : as) start = start * size + el - as[0];
-        } else {
-            for (auto el : as) start = start * size + el;
-        }
-        start *= agentsNum;
-        return toVec(data | drop(start) | take(agentsNum));
-    };
-}
-
-auto rdLottery(l<size_t> x) EXPR(l<real>(x.size(), 1. / x.size()))
-
-lottery reversedLottery(size_t size, const lottery &lot) {
-    return [size, lot](const l<size_t> &as) {
-        return toVec(lot(toVec(as | reverse | transform([size](size_t x)EXPR(size - x)))) | reverse);
-    };
-}
-
-lottery mixedLottery(size_t size, real a, const lottery &lot1, const lottery &lot2) {
-    return [=](const l<size_t> &as) {
-        auto res = lot1(as);
-        auto tmp = lot2(as);
-        for (size_t i = 0; i < res.size(); ++i) {
-            res[i] = res[i] * a + tmp[i] * (1 - a);
-        }
-        return res;
-    };
-}
-
-const real multipliers[] = {6, 3, 1};
-lottery randomizedLottery(const lottery &lot) {
-    return [=](const l<size_t> &as) {
-        l<size_t> as2;
-        l<real> res(as.size(), 0);
-        size_t agents_num = as.size();
-        size_t div = agents_num * agents_num * agents_num;
-        for (size_t i0 = 0; i0 < agents_num; ++i0)
-        {
-            as2.push_back(as[i0]);
-            for (size_t i1 = i0; i1 < agents_num; ++i1)
-            {
-                as2.push_back(as[i1]);
-                for (size_t i2 = i1; i2 < agents_num; ++i2)
-                {
-                    as2.push_back(as[i2]);
-                    size_t eq_num = (i0 == i1) + (i1 == i2);
-                    real mul = multipliers[eq_num];
-                    l<real> innerRes = lot(as2);
-                    res[i0] += mul * innerRes[0];
-                    res[i1] += mul * innerRes[1];
-                    res[i2] += mul * innerRes[2];
-                    as2.pop_back();
-                }
-                as2.pop_back();
-            }
-            as2.pop_back();
-        }
-        for (auto &el : res) el /= div;
-        return res;
-    };
-}
-
-lottery randomizedLottery2(const lottery &lot) {
-    return [=](const l<size_t> &as) {
-        l<size_t> as2;
-        l<real> res(as.size(), 0);
-        size_t agents_num = as.size();
-        size_t div = agents_num * (agents_num - 1) * (agents_num - 2) / 6;
-        for (size_t i0 = 0; i0 < agents_num; ++i0)
-        {
-            as2.push_back(as[i0]);
-            for (size_t i1 = i0 + 1; i1 < agents_num; ++i1)
-            {
-                as2.push_back(as[i1]);
-                for (size_t i2 = i1 + 1; i2 < agents_num; ++i2)
-                {
-                    as2.push_back(as[i2]);
-                    l<real> innerRes = lot(as2);
-                    res[i0] += innerRes[0];
-                    res[i1] += innerRes[1];
-                    res[i2] += innerRes[2];
-                    as2.pop_back();
-                }
-                as2.pop_back();
-            }
-            as2.pop_back();
-        }
-        for (auto &el : res) el /= div;
-        return res;
-    };
-}
-
 class Graph {
     public:
     Graph(size_t size) : size(size) {}
     const size_t size;
     virtual real distance(size_t a, size_t b) const = 0;
+    // position of vertex on the circle of length 1 the graph is taken from
+    virtual real position(size_t v) const EXPR(real(v) / size)
+    // Whether profiles are taken up to rotations of the graph, with an agent at vertex 0, whose
+    // deviations stand for those of all agents (vertex 0 is then not printed). Otherwise all
+    // profiles are enumerated and deviations of every agent are checked.
+    virtual bool anchored() const EXPR(true)
+    // social cost of facility placed at vertex of each agent of seq
+    virtual l<real> agentCosts(const l<size_t> &seq) const {
+        l<real> res;
+        res.reserve(seq.size());
+        for (size_t a : seq) res.push_back(sum(seq | transform([&](size_t x) EXPR(distance(a, x)))));
+        return res;
+    }
 };
 
 class SplitCircle : public Graph {
     public:
     const size_t splitVertex;
     SplitCircle(size_t size, size_t splitVertex) : Graph(size), splitVertex(splitVertex) {}
+    // vertices of the line differ by their distances to its ends
+    bool anchored() const override EXPR(false)
     real distance(size_t a, size_t b) const override {
         return abs(int((b + size -  splitVertex) % size) - int((a + size - splitVertex) % size)) / real(size);
     }
+    // on the line agents are ordered starting from the first one not before the split vertex,
+    // so costs follow from prefix sums of their positions in O(n)
+    l<real> agentCosts(const l<size_t> &seq) const override {
+        const size_t agentsNum = seq.size();
+        const size_t first = rn::lower_bound(seq, splitVertex) - seq.begin();
+        auto position = [&](size_t i) EXPR((seq[(first + i) % agentsNum] + size - splitVertex) % size);
+        size_t total = 0;
+        for (size_t i = 0; i < agentsNum; ++i) total += position(i);
+        l<real> res = VectorPool<real>::take();
+        res.resize(agentsNum);
+        size_t prefix = 0;
+        for (size_t i = 0; i < agentsNum; ++i) {
+            const size_t p = position(i);
+            const size_t below = p * i - prefix;
+            const size_t above = total - prefix - p * (agentsNum - i);
+            res[(first + i) % agentsNum] = real(below + above) / size;
+            prefix += p;
+        }
+        return res;
+    }
 };
 
 class Circle : public Graph {
@@ -341,23 +511,86 @@ class Circle : public Graph {
         size_t diff = a < b ? b - a : a - b;
         return min(diff, size - diff) / real(size);
     }
+    // agents at most half of the circle clockwise are reached clockwise, the others
+    // counterclockwise; with prefix sums of positions unrolled twice this takes O(n)
+    l<real> agentCosts(const l<size_t> &seq) const override {
+        const size_t agentsNum = seq.size();
+        auto unrolled = [&](size_t k) EXPR(seq[k % agentsNum] + size * (k / agentsNum));
+        l<size_t> prefix = VectorPool<size_t>::take();
+        prefix.assign(2 * agentsNum + 1, 0);
+        for (size_t k = 0; k < 2 * agentsNum; ++k) prefix[k + 1] = prefix[k] + unrolled(k);
+        l<real> res = VectorPool<real>::take();
+        res.resize(agentsNum);
+        size_t right = 0;
+        for (size_t i = 0; i < agentsNum; ++i) {
+            const size_t x = seq[i];
+            right = max(right, i + 1);
+            while (right < i + agentsNum && 2 * (unrolled(right) - x) <= size) ++right;
+            const size_t clockwise = prefix[right] - prefix[i + 1] - (right - i - 1) * x;
+            const size_t counterclockwise = (i + agentsNum - right) * (x + size) - (prefix[i + agentsNum] - prefix[right]);
+            res[i] = real(clockwise + counterclockwise) / size;
+        }
+        VectorPool<size_t>::give(std::move(prefix));
+        return res;
+    }
     SplitCircle split(size_t splitVertex) const {
         return SplitCircle(size, splitVertex);
     }
 };
 
+// Circle of length 1 with vertices at given positions. Positions are reduced modulo 1
+// and sorted once, so that distances need no rounding.
 class CustomCircle : public Graph {
     private:
     l<real> vertices;
+    static l<real> normalized(l<real> vertices) {
+        for (real &x : vertices) x -= floor(x);
+        rn::sort(vertices);
+        return vertices;
+    }
     public:
-    CustomCircle(l<real> vertices) : Graph(vertices.size()), vertices(vertices) {}
+    CustomCircle(l<real> vertices) : Graph(vertices.size()), vertices(normalized(std::move(vertices))) {}
+    // rotations of the circle do not map vertices onto vertices in general
+    bool anchored() const override EXPR(false)
+    real position(size_t v) const override EXPR(vertices[v])
+    const l<real> &positions() const EXPR(vertices)
     real distance(size_t a, size_t b) const override {
-        real diff = vertices[a] - vertices[b];
-        real diff2 = diff - floor(diff);
-        return min(diff2, 1 - diff2);
+        real diff = vertices[a] < vertices[b] ? vertices[b] - vertices[a] : vertices[a] - vertices[b];
+        return min(diff, 1 - diff);
+    }
+    // as Circle::agentCosts, with positions of vertices
+    l<real> agentCosts(const l<size_t> &seq) const override {
+        const size_t agentsNum = seq.size();
+        auto unrolled = [&](size_t k) EXPR(vertices[seq[k % agentsNum]] + real(k / agentsNum));
+        l<real> prefix = VectorPool<real>::take();
+        prefix.assign(2 * agentsNum + 1, 0);
+        for (size_t k = 0; k < 2 * agentsNum; ++k) prefix[k + 1] = prefix[k] + unrolled(k);
+        l<real> res = VectorPool<real>::take();
+        res.resize(agentsNum);
+        size_t right = 0;
+        for (size_t i = 0; i < agentsNum; ++i) {
+            const real x = vertices[seq[i]];
+            right = max(right, i + 1);
+            while (right < i + agentsNum && 2 * (unrolled(right) - x) <= 1) ++right;
+            const real clockwise = prefix[right] - prefix[i + 1] - real(right - i - 1) * x;
+            const real counterclockwise = real(i + agentsNum - right) * (x + 1) - (prefix[i + agentsNum] - prefix[right]);
+            res[i] = clockwise + counterclockwise;
+        }
+        VectorPool<real>::give(std::move(prefix));
+        return res;
     }
 };
 
+// Reads whitespace separated positions of vertices on circle of length 1.
+l<real> loadPositions(const string &path) {
+    std::ifstream in(path);
+    if (!in) throw std::runtime_error("cannot open vertex positions: " + path);
+    l<real> res{std::istream_iterator<real>(in), std::istream_iterator<real>()};
+    if (!in.eof()) throw std::runtime_error("malformed vertex positions: " + path);
+    if (res.empty()) throw std::runtime_error("no vertex positions in: " + path);
+    return res;
+}
+
 template<typename T>
 class gen {
 public:
@@ -369,8 +602,12 @@ public:
     virtual const T &get() const EXPR(currentEl)
     virtual T &get() EXPR(currentEl)
     virtual bool next() = 0;
+    bool advance() {
+        STAGE(generation);
+        return next();
+    }
     cppcoro::generator<const T&> toGen() {
-        while (next()) co_yield get();
+        while (advance()) co_yield get();
         co_return;
     }
 
@@ -379,27 +616,206 @@ public:
 using std::reference_wrapper;
 using conf=std::pair<reference_wrapper<const Graph>, reference_wrapper<const l<size_t>>>;
 
-class seqs : public gen<l<size_t>> {
-protected:
-    size_t start;
-    size_t end;
-    size_t size;
+// Lexicographic ranking (combinatorial number system) of sequences processed by
+// generators: first element followed by nondecreasing values from [first, first + size),
+// with at most bound distinct values (0 means no bound).
+class SeqRanker {
+    static constexpr size_t inf = numeric_limits<size_t>::max();
+    size_t size, len, bound;
+    // binomial coefficients saturated at inf
+    l<l<size_t>> binom;
+    static size_t add(size_t a, size_t b) EXPR(a > inf - b ? inf : a + b)
+    static size_t mul(size_t a, size_t b) EXPR(a != 0 && b > inf / a ? inf : a * b)
+    size_t C(size_t n, size_t k) const EXPR(k > n ? 0 : binom[n][k])
+    // number of nondecreasing continuations of length m of sequence ending with v,
+    // introducing at most d new distinct values
+    size_t count(size_t m, size_t v, size_t d) const {
+        if (!bound) return C(size - 1 - v + m, m);
+        size_t res = 0;
+        for (size_t j = 0; j <= min(d, m); ++j) res = add(res, mul(C(size - 1 - v, j), C(m, j)));
+        return res;
+    }
+    // number of sequences in which value w follows v and then m values follow
+    size_t countAfter(size_t v, size_t w, size_t m, size_t d) const {
+        if (w == v || !bound) return count(m, w, d);
+        return d ? count(m, w, d - 1) : 0;
+    }
 public:
-    seqs(size_t start, size_t end, size_t size)
-    : gen<l<size_t>>(l<size_t>{start-1ul})
-    , start(start), end(end), size(size) {}
-    virtual double approxSize() const = 0;
+    SeqRanker(size_t size, size_t len, size_t bound = 0) : size(size), len(len), bound(bound), binom(size + len + 1) {
+        for (size_t n = 0; n < binom.size(); ++n) {
+            binom[n].resize(min(n, len) + 1, 1);
+            for (size_t k = 1; k < n && k <= len; ++k)
+                binom[n][k] = add(binom[n - 1][k - 1], k < binom[n - 1].size() ? binom[n - 1][k] : 0);
+        }
+        if (total() == inf) throw std::overflow_error("sequence space too large to rank");
+    }
+    size_t total() const EXPR(count(len - 1, 0, bound ? bound - 1 : 0))
+    size_t rank(const l<size_t> &seq) const {
+        size_t res = 0, d = bound ? bound - 1 : 0;
+        for (size_t i = 1; i < len; ++i) {
+            for (size_t w = seq[i - 1]; w < seq[i]; ++w) res += countAfter(seq[i - 1] - seq[0], w - seq[0], len - 1 - i, d);
+            if (bound && seq[i] != seq[i - 1]) --d;
+        }
+        return res;
+    }
+    l<size_t> unrank(size_t rank, size_t first = 0) const {
+        if (rank >= total()) throw std::out_of_range("rank out of range");
+        l<size_t> seq{0};
+        size_t d = bound ? bound - 1 : 0;
+        for (size_t i = 1; i < len; ++i) {
+            size_t w = seq.back();
+            for (size_t c; rank >= (c = countAfter(seq.back(), w, len - 1 - i, d)); ++w) rank -= c;
+            if (bound && w != seq.back()) --d;
+            seq.push_back(w);
+        }
+        for (size_t &x : seq) x += first;
+        return seq;
+    }
 };
 
-template<typename T, class... Args>
-cppcoro::generator<const typename T::value_type&> makeGen(Args... args) {
-    T g(std::forward<Args>(args)...);
-    while (g.next()) co_yield g.get();
-    co_return;
-}
-
-template<typename T, class... Args>
-cppcoro::generator<conf> genConfs(const Graph &graph, Args... args) {
+// Space of sequences enumerated by generators: 0 followed by size - 1 nondecreasing values
+// from [0, values), with at most distinctBound distinct values (0 means no bound), optionally
+// only balanced ones (no gap of the circle of size values longer than half of it), dominant
+// ones (more than half of agents on one vertex) and those not greater than their mirror image
+// (see isNotReversed). Counted exactly (while below 2^53) without enumerating.
+struct SeqSpace {
+    size_t values, size;
+    size_t distinctBound = 0;
+    bool asymmetric = false, balanced = false, dominant = false;
+
+    double count() const {
+        if (values == 0 || size == 0) return 0;
+        const size_t maxDistinct = min(distinctBound ? distinctBound : size, min(size, values));
+        // A sequence is given by the set of occupied vertices and their multiplicities, which
+        // are constrained independently: balance by gaps between the vertices, dominance by
+        // multiplicities and the bound by their number.
+        double res = 0;
+        const l<double> vertexSets = occupiedSets(maxDistinct);
+        for (size_t d = 1; d <= maxDistinct; ++d) res += vertexSets[d] * multiplicities(d);
+        return asymmetric ? (res + symmetric()) / 2 : res;
+    }
+private:
+    // numbers of sets of d vertices including 0, for each d up to maxDistinct
+    l<double> occupiedSets(size_t maxDistinct) const {
+        l<double> res(maxDistinct + 1);
+        if (!balanced) {
+            for (size_t d = 1; d <= maxDistinct; ++d) res[d] = binomialCoefficient(values - 1, d - 1);
+            return res;
+        }
+        // compositions of the circle into d gaps of length from [1, values / 2]
+        const size_t maxGap = values / 2;
+        l<double> ways(values + 1), next(values + 1), prefix(values + 2);
+        ways[0] = 1;
+        for (size_t d = 1; d <= maxDistinct; ++d) {
+            for (size_t s = 0; s <= values; ++s) prefix[s + 1] = prefix[s] + ways[s];
+            for (size_t s = 0; s <= values; ++s) next[s] = s ? prefix[s] - prefix[s - min(s, maxGap)] : 0;
+            std::swap(ways, next);
+            res[d] = ways[values];
+        }
+        return res;
+    }
+    // numbers of ways to distribute size agents among d occupied vertices
+    double multiplicities(size_t d) const {
+        if (!dominant) return binomialCoefficient(size - 1, d - 1);
+        if (d == 1) return 1;
+        // at most one vertex has more than half of agents
+        double res = 0;
+        for (size_t m = size / 2 + 1; m + d - 1 <= size; ++m) res += binomialCoefficient(size - m - 1, d - 2);
+        return res * d;
+    }
+    // number of sequences equal to their mirror image, in which vertices v and values - v
+    // have the same multiplicities
+    double symmetric() const {
+        // vertices other than 0 and values / 2 form pairs {v, values - v} for v from [1, pairs]
+        const size_t pairs = (values - 1) / 2, maxHalf = values % 2 ? 0 : size;
+        // gap between v and values - v is short enough for v not below shortGap
+        const size_t shortGap = (values - values / 2 + 1) / 2;
+        const size_t longGapPairs = min(pairs, shortGap - 1);
+        double res = 0;
+        for (size_t atZero = 1; atZero <= size; ++atZero) {
+            for (size_t atHalf = 0; atHalf <= min(maxHalf, size - atZero); ++atHalf) {
+                const size_t rest = size - atZero - atHalf;
+                if (rest % 2) continue;
+                if (dominant && atZero <= size / 2 && atHalf <= size / 2) continue;
+                // rest / 2 agents on each side, on j occupied pairs
+                for (size_t j = rest ? 1 : 0; j <= min(pairs, rest / 2); ++j) {
+                    if (distinctBound && 1 + (atHalf > 0) + 2 * j > distinctBound) continue;
+                    double pairSets = binomialCoefficient(pairs, j);
+                    // without vertex values / 2 some occupied pair has to close the circle
+                    if (balanced && !atHalf) pairSets -= binomialCoefficient(longGapPairs, j);
+                    res += pairSets * (j ? binomialCoefficient(rest / 2 - 1, j - 1) : 1);
+                }
+            }
+        }
+        return res;
+    }
+};
+
+class Profile;
+
+class seqs : public gen<l<size_t>> {
+protected:
+    size_t start;
+    size_t end;
+    size_t size;
+public:
+    seqs(size_t start, size_t end, size_t size)
+    : gen<l<size_t>>(l<size_t>{start-1ul})
+    , start(start), end(end), size(size) {}
+    // number of sequences yielded, exact when the space is known (see space())
+    virtual double approxSize() const = 0;
+    // space of yielded sequences, if they are all of one that can be counted
+    virtual std::optional<SeqSpace> space() const EXPR(std::nullopt)
+    // whether approxSize is exact (while below 2^53) rather than an estimate or a bound
+    virtual bool exactSize() const EXPR(space().has_value())
+    // whether approxSize, when not exact, bounds the number from above rather than estimates it
+    virtual bool boundingSize() const EXPR(true)
+    // Ranks order sequences lexicographically. Generators skipping some sequences
+    // (e.g. reversed ones) use ranks of the enclosing space, so theirs are sparse.
+    virtual size_t rank() const { throw std::logic_error("generator does not support ranking"); }
+    // one past the greatest rank
+    virtual size_t rankBound() const { throw std::logic_error("generator does not support ranking"); }
+    virtual l<size_t> unrank(size_t) const { throw std::logic_error("generator does not support ranking"); }
+    // makes next() yield the first sequence of rank not smaller than given
+    virtual void seek(size_t) { throw std::logic_error("generator does not support ranking"); }
+    // whether sequence of given rank (as unranked) is yielded, for generators skipping some
+    virtual bool yields(const l<size_t> &) const EXPR(true)
+    // social costs of agents of the current sequence on g, if the generator maintains them
+    virtual const l<real> *knownAgentCosts(const Graph &) const EXPR(nullptr)
+    // profile of the current sequence on g, if the generator has built one (filters do)
+    virtual const Profile *currentProfile(const Graph &) const EXPR(nullptr)
+};
+
+// Base of generators enumerating (a subset of) sequences in order of SeqRanker.
+class ranked_seqs : public seqs {
+    size_t distinctBound;
+    mutable std::optional<SeqRanker> ranker;
+    // constructed lazily, as spaces too large to rank may still be enumerated
+    const SeqRanker &getRanker() const {
+        if (!ranker) ranker.emplace(end - start, size, distinctBound);
+        return *ranker;
+    }
+public:
+    ranked_seqs(size_t start, size_t end, size_t size, size_t distinctBound = 0)
+    : seqs(start, end, size), distinctBound(distinctBound) {}
+    size_t rank() const override EXPR(getRanker().rank(get()))
+    size_t rankBound() const override EXPR(getRanker().total())
+    l<size_t> unrank(size_t rank) const override EXPR(getRanker().unrank(rank, start))
+    void seek(size_t rank) override {
+        if (rank == 0) get().assign(1, start - 1);
+        else get() = unrank(min(rank, rankBound()) - 1);
+    }
+};
+
+template<typename T, class... Args>
+cppcoro::generator<const typename T::value_type&> makeGen(Args... args) {
+    T g(std::forward<Args>(args)...);
+    while (g.next()) co_yield g.get();
+    co_return;
+}
+
+template<typename T, class... Args>
+cppcoro::generator<conf> genConfs(const Graph &graph, Args... args) {
     T g(0, graph.size, std::forward<Args>(args)...);
     while (g.next()) co_yield std::make_pair(std::ref(graph), std::ref(g.get()));
     co_return;
@@ -416,12 +832,12 @@ public:
         {
             if (line.starts_with("print "))
             {
-                std::cout << line.substr(6);
+                cout << line.substr(6);
                 return next();
             }
             else if (line.starts_with("println "))
             {
-                std::cout << line.substr(8) << '\n';
+                cout << line.substr(8) << '\n';
                 return next();
             }
             get().clear();
@@ -437,7 +853,7 @@ public:
                     }
                     catch (const std::invalid_argument &e)
                     {
-                        std::cout << "Error: " << e.what() << " on arg: " << line.substr(pos, nextDelim) << '\n';
+                        cout << "Error: " << e.what() << " on arg: " << line.substr(pos, nextDelim) << '\n';
                         return next();
                     }
                 }
@@ -451,13 +867,23 @@ public:
         }
         return false;
     }
+    // lines are not known before they are read
     double approxSize() const EXPR(0);
 };
 
-class increasing_seqs : public seqs
+// Whether seq (starting with 0) is not greater than canonical form of its mirror
+// image, so that only one of each pair of mirrored sequences is processed.
+bool isNotReversed(const l<size_t> &seq, size_t end) {
+    size_t numOfZeros = 0;
+    for (auto i = seq.begin(); *i == 0; ++i) ++numOfZeros;
+    auto invertedSeq = repeat(seq | reverse | transform([&](size_t x)EXPR((end - x) % end))) | join | drop(seq.size() - numOfZeros);
+    return !rn::lexicographical_compare(invertedSeq, seq);
+}
+
+class increasing_seqs : public ranked_seqs
 {
 public:
-    increasing_seqs(size_t start, size_t end, size_t size) : seqs(start, end, size) {}
+    increasing_seqs(size_t start, size_t end, size_t size) : ranked_seqs(start, end, size) {}
     bool next() {
         while (get().back() == end - 1) {
             get().pop_back();
@@ -467,12 +893,146 @@ public:
         while(get().size() < size) get().push_back(get().back());
         return true;
     }
-    double approxSize() const EXPR(numOfIncreasingSeqs(size, end - start));
+    double approxSize() const EXPR(space()->count());
+    std::optional<SeqSpace> space() const override EXPR((SeqSpace{end - start, size}))
+};
+
+// All nondecreasing sequences of size values from [start, end), for graphs that are not
+// anchored (see Graph::anchored). They are sequences of increasing_seqs one longer with the
+// leading start dropped, ranked as those.
+class path_seqs : public seqs {
+    increasing_seqs anchored;
+public:
+    path_seqs(size_t start, size_t end, size_t size) : seqs(start, end, size), anchored(start, end, size + 1) {}
+    bool next() {
+        if (!anchored.next()) return false;
+        get().assign(anchored.get().begin() + 1, anchored.get().end());
+        return true;
+    }
+    double approxSize() const EXPR(anchored.approxSize());
+    bool exactSize() const override EXPR(true)
+    size_t rank() const override EXPR(anchored.rank())
+    size_t rankBound() const override EXPR(anchored.rankBound())
+    l<size_t> unrank(size_t rank) const override {
+        l<size_t> res = anchored.unrank(rank);
+        res.erase(res.begin());
+        return res;
+    }
+    void seek(size_t rank) override { anchored.seek(rank); }
+};
+
+// Sequences of increasing_seqs ordered so that consecutive ones differ by the position of
+// a single agent: sequences with k agents at the least value follow for k decreasing, each
+// block listed recursively in alternating directions. Moving the agent by a single step is
+// not always possible (no such order exists for 3 agents on 3 vertices), so it may jump.
+// Once asked for, costs of agents on the circle of size end - start are updated by the
+// move in O(n) instead of being recomputed.
+class gray_seqs : public seqs {
+    // block of sequences having get()[0..offset) fixed and the others not smaller than least;
+    // forward order starts with all of them equal to least and ends with all equal to end - 1
+    struct Block {
+        size_t offset, least;
+        bool forward;
+        // index of the current sub-block, listing sequences with (forward ? t : remaining - t)
+        // of the remaining agents above least
+        size_t t = 0;
+    };
+    l<Block> blocks;
+    bool started = false;
+    mutable bool costsWanted = false;
+    bool costsKnown = false;
+    l<size_t> previous;
+    // costs in units of edge length, exact so that they match Circle::agentCosts
+    l<size_t> sums, updated;
+    l<real> costs;
+    size_t distance(size_t a, size_t b) const {
+        size_t diff = a < b ? b - a : a - b;
+        return min(diff, end - start - diff);
+    }
+    size_t sumOfDistances(size_t x) const {
+        size_t res = 0;
+        for (size_t y : get()) res += distance(x, y);
+        return res;
+    }
+    // enters first sub-blocks until the block of a single sequence
+    void descend() {
+        for (;;) {
+            const Block &b = blocks.back();
+            const size_t remaining = size - b.offset;
+            if (remaining == 0 || b.least == end - 1) {
+                std::fill(get().begin() + b.offset, get().end(), b.least);
+                return;
+            }
+            const size_t atLeast = b.forward ? remaining - b.t : b.t;
+            std::fill(get().begin() + b.offset, get().begin() + b.offset + atLeast, b.least);
+            blocks.push_back({b.offset + atLeast, b.least + 1, (atLeast % 2 == 0) == b.forward});
+        }
+    }
+    void updateCosts() {
+        const l<size_t> &seq = get();
+        if (!costsKnown) {
+            sums.resize(size);
+            for (size_t i = 0; i < size; ++i) sums[i] = sumOfDistances(seq[i]);
+            costsKnown = true;
+        }
+        else {
+            // the moved agent left value from and arrived at value to
+            size_t from = 0, to = 0, i = 0, j = 0;
+            while (i < size && j < size) {
+                if (previous[i] == seq[j]) ++i, ++j;
+                else if (previous[i] < seq[j]) from = previous[i++];
+                else to = seq[j++];
+            }
+            if (i < size) from = previous[i];
+            if (j < size) to = seq[j];
+            const size_t toSum = sumOfDistances(to);
+            updated.resize(size);
+            for (size_t k = 0, p = 0; k < size; ++k) {
+                if (seq[k] == to) {
+                    updated[k] = toSum;
+                    continue;
+                }
+                while (previous[p] < seq[k]) ++p;
+                updated[k] = sums[p] + distance(seq[k], to) - distance(seq[k], from);
+            }
+            std::swap(sums, updated);
+        }
+        previous = seq;
+        costs.resize(size);
+        for (size_t k = 0; k < size; ++k) costs[k] = real(sums[k]) / (end - start);
+    }
+public:
+    gray_seqs(size_t start, size_t end, size_t size) : seqs(start, end, size) {}
+    bool next() override {
+        if (!started) {
+            started = true;
+            get().assign(size, start);
+            blocks.push_back({1, start, true});
+            descend();
+        }
+        else {
+            if (blocks.empty()) return false;
+            blocks.pop_back();
+            while (!blocks.empty() && blocks.back().t == size - blocks.back().offset) blocks.pop_back();
+            if (blocks.empty()) return false;
+            ++blocks.back().t;
+            descend();
+        }
+        if (costsWanted) updateCosts();
+        return true;
+    }
+    double approxSize() const EXPR(space()->count());
+    std::optional<SeqSpace> space() const override EXPR((SeqSpace{end - start, size}))
+    const l<real> *knownAgentCosts(const Graph &g) const override {
+        if (!dynamic_cast<const Circle *>(&g) || start != 0 || g.size != end) return nullptr;
+        costsWanted = true;
+        return costsKnown ? &costs : nullptr;
+    }
 };
 
-class increasing_asymmetric_seqs : public seqs {
+class increasing_asymmetric_seqs : public ranked_seqs {
 public:
-    increasing_asymmetric_seqs(size_t start, size_t end, size_t size) : seqs(start, end, size) {}
+    increasing_asymmetric_seqs(size_t start, size_t end, size_t size) : ranked_seqs(start, end, size) {}
     bool next() {
         for(;;) {
             while (get().back() == end - 1) {
@@ -481,29 +1041,29 @@ public:
             }
             ++get().back();
             while(get().size() < size) get().push_back(get().back());
-            size_t numOfZeros = 0;
-            for (auto i = get().begin(); *i == 0; ++i) ++numOfZeros;
-            auto invertedSeq = repeat(get() | reverse | transform([&](size_t x)EXPR((end - x) % end))) | join | drop(size - numOfZeros);
-            if (!rn::lexicographical_compare(invertedSeq, get())) return true;
-            else get().pop_back();
+            if (isNotReversed(get(), end)) return true;
+            get().pop_back();
+            if (get().size() == 1) return false;
         }
     }
-    double approxSize() const EXPR(numOfIncreasingSeqs(size, end - start) / 2);
+    bool yields(const l<size_t> &seq) const override EXPR(isNotReversed(seq, end))
+    double approxSize() const EXPR(space()->count());
+    std::optional<SeqSpace> space() const override EXPR((SeqSpace{end - start, size, 0, true}))
 };
 
 template<bool asymmetric = true>
-class increasing_boring_asymmetric_seqs : public seqs {
+class increasing_boring_asymmetric_seqs : public ranked_seqs {
 private:
     size_t bound;
     size_t numOfDiffValues = 1;
     size_t pop() {
         size_t lastEl = get().back();
-        if (lastEl != *prev(get().end(), 2)) --numOfDiffValues;
+        if (get().size() > 1 && lastEl != *prev(get().end(), 2)) --numOfDiffValues;
         get().pop_back();
         return lastEl;
     }
     bool push(size_t el) {
-        if (get().back() != el) {
+        if (!get().empty() && get().back() != el) {
             if (numOfDiffValues >= bound) return false;
             ++numOfDiffValues;
         }
@@ -511,34 +1071,97 @@ private:
         return true;
     }
 public:
-    increasing_boring_asymmetric_seqs(size_t start, size_t end, size_t size, size_t bound) : seqs(start, end, size), bound(bound) {}
+    increasing_boring_asymmetric_seqs(size_t start, size_t end, size_t size, size_t bound) : ranked_seqs(start, end, size, bound), bound(bound) {}
+    void seek(size_t rank) override {
+        ranked_seqs::seek(rank);
+        numOfDiffValues = 1;
+        for (size_t i = 1; i < get().size(); ++i) numOfDiffValues += get()[i] != get()[i - 1];
+    }
     bool next() {
         for(;;) {
             while (get().back() == end - 1) {
                 pop();
                 if (get().size() == 1) return false;
             }
-            if(!push(pop()+1)) continue;
+            if(!push(pop()+1)) {
+                if (get().size() == 1) return false;
+                continue;
+            }
             while(get().size() < size) get().push_back(get().back());
-            if (!asymmetric) return true;
-            size_t numOfZeros = 0;
-            for (auto i = get().begin(); *i == 0; ++i) ++numOfZeros;
-            auto invertedSeq = repeat(get() | reverse | transform([&](size_t x)EXPR((end - x) % end))) | join | drop(size - numOfZeros);
-            if (!rn::lexicographical_compare(invertedSeq, get())) return true;
-            else pop();
+            if (!asymmetric || isNotReversed(get(), end)) return true;
+            pop();
+            if (get().size() == 1) return false;
         }
     }
-    double approxSize() const {
-        double res = 0;
-        for (size_t i = 1; i <= bound; ++i) {
-            res += binomialCoefficient(end - start, i) * numOfIncreasingSeqs(size - i, i) / 2;
+    bool yields(const l<size_t> &seq) const override EXPR(!asymmetric || isNotReversed(seq, end))
+    double approxSize() const EXPR(space()->count());
+    std::optional<SeqSpace> space() const override EXPR((SeqSpace{end - start, size, bound, asymmetric}))
+};
+
+// Draws size-k subset of {0, ..., n-1} uniformly (Floyd's algorithm) into res, in increasing order.
+template<typename R>
+void randomSubset(R &rng, size_t n, size_t k, l<size_t> &res) {
+    res.clear();
+    for (size_t j = n - k; j < n; ++j) {
+        size_t t = std::uniform_int_distribution<size_t>(0, j)(rng);
+        auto it = rn::lower_bound(res, t);
+        // j exceeds all drawn elements
+        if (it != res.end() && *it == t) res.push_back(j);
+        else res.insert(it, t);
+    }
+}
+
+// Draws given number of sequences uniformly at random from the space processed by
+// increasing_seqs, or by increasing_boring_asymmetric_seqs<asymmetric> if bound > 0
+// (with asymmetric it is restricted like increasing_asymmetric_seqs).
+class random_seqs : public seqs {
+    std::mt19937_64 rng;
+    size_t remaining;
+    size_t bound;
+    bool asymmetric;
+    // weights of numbers of distinct values when bound is set
+    std::discrete_distribution<size_t> distinctValues;
+    // reused between draws
+    l<size_t> bars, values, cuts;
+    void draw() {
+        l<size_t> &seq = get();
+        if (!bound) {
+            // stars and bars: positions of bars determine nondecreasing sequence
+            randomSubset(rng, end - start + size - 2, size - 1, bars);
+            seq.assign(1, 0);
+            for (size_t i = 0; i < bars.size(); ++i) seq.push_back(bars[i] - i);
+            return;
+        }
+        size_t distinct = distinctValues(rng) + 1;
+        randomSubset(rng, end - start - 1, distinct - 1, values);
+        randomSubset(rng, size - 1, distinct - 1, cuts);
+        seq.assign(size, 0);
+        for (size_t i = 0; i < values.size(); ++i) {
+            for (size_t j = cuts[i] + 1; j < size; ++j) seq[j] = values[i] + 1;
+        }
+    }
+public:
+    random_seqs(size_t start, size_t end, size_t size, size_t samples, std::seed_seq &&seed, size_t bound = 0, bool asymmetric = false)
+    : seqs(start, end, size), rng(seed), remaining(samples), bound(bound), asymmetric(asymmetric) {
+        if (bound) {
+            l<real> weights;
+            for (size_t d = 1; d <= min(bound, size); ++d)
+                weights.push_back(binomialCoefficient(end - start - 1, d - 1) * binomialCoefficient(size - 1, d - 1));
+            distinctValues = std::discrete_distribution<size_t>(weights.begin(), weights.end());
         }
-        return res; // slightly overestimated
     }
+    bool next() override {
+        if (remaining == 0) return false;
+        --remaining;
+        do draw(); while (asymmetric && !isNotReversed(get(), end));
+        return true;
+    }
+    double approxSize() const override EXPR(remaining);
+    bool exactSize() const override EXPR(true)
 };
 
 l<real> oppositeDistances(const Graph &g, const l<size_t> &seq) {
-    l<real> res;
+    l<real> res = VectorPool<real>::take();
     size_t n = seq.size();
     res.reserve(n);
     for (size_t i = 0; i < n; ++i) {
@@ -548,364 +1171,2293 @@ l<real> oppositeDistances(const Graph &g, const l<size_t> &seq) {
     return res;
 }
 
-real pcdBoundValue(const Graph &g, const l<size_t> &seq) {
-    auto dis_opp = oppositeDistances(g, seq);
-    real optimalCost = sum(dis_opp);
-    real realCost = 2* sum(dis_opp | transform([&](real x) EXPR(x * (1 - x))));
-    return nzero(optimalCost) ? realCost / optimalCost : (nzero(realCost) ? numeric_limits<real>::infinity() : 1);
-}
-
 real getVertexCost(const Graph &g, const l<size_t> &seq, size_t vertex) {
+    STAGE(cost);
     return sum(seq | transform([&](size_t x) EXPR(g.distance(vertex, x))));
 }
 
-real getLotteryCost(const lottery &lot, const Graph &g, const l<size_t> &seq) {
-    real realCost = 0;
-    for (const auto &[a, p] : zip(seq, lot(seq))) {
-        real c = getVertexCost(g, seq, a);
-        realCost += p * c;
+// Data derived from a single profile, computed lazily on first use, so that
+// quantities, lotteries and filters evaluating the same profile share it.
+class Profile {
+    const Graph &g;
+    const l<size_t> &seq;
+    mutable std::optional<l<real>> costs, opposite, gapsAfter;
+    mutable std::optional<size_t> opt;
+public:
+    // costs maintained by the generator, if any, spare recomputing them
+    Profile(const Graph &g, const l<size_t> &seq, const l<real> *knownCosts = nullptr) : g(g), seq(seq) {
+        if (knownCosts) {
+            costs = VectorPool<real>::take();
+            costs->assign(knownCosts->begin(), knownCosts->end());
+        }
     }
-    return realCost;
+    Profile(conf c) : Profile(c.first.get(), c.second.get()) {}
+    Profile(const Profile &) = delete;
+    ~Profile() {
+        if (costs) VectorPool<real>::give(std::move(*costs));
+        if (opposite) VectorPool<real>::give(std::move(*opposite));
+        if (gapsAfter) VectorPool<real>::give(std::move(*gapsAfter));
+    }
+    const Graph &graph() const EXPR(g)
+    const l<size_t> &agents() const EXPR(seq)
+    // social cost of facility placed at each agent
+    const l<real> &agentCosts() const {
+        if (!costs) costs = g.agentCosts(seq);
+        return *costs;
+    }
+    real optCost() const EXPR(minimum(agentCosts()))
+    // distance of each agent to the one opposite to it
+    const l<real> &oppositeDistances() const {
+        if (!opposite) opposite = ::oppositeDistances(g, seq);
+        return *opposite;
+    }
+    // length of the arc from each agent clockwise to the next one, the last one reaching the
+    // first across vertex 0, so that they sum to 1
+    const l<real> &gaps() const {
+        if (gapsAfter) return *gapsAfter;
+        gapsAfter = VectorPool<real>::take();
+        const size_t n = seq.size();
+        gapsAfter->resize(n);
+        for (size_t i = 0; i + 1 < n; ++i) (*gapsAfter)[i] = g.position(seq[i + 1]) - g.position(seq[i]);
+        (*gapsAfter)[n - 1] = g.position(seq[0]) + 1 - g.position(seq[n - 1]);
+        return *gapsAfter;
+    }
+    // first agent of minimal cost among agents having half of the others on each side
+    size_t optAgent() const {
+        if (opt) return *opt;
+        opt = 0;
+        real min_cost = numeric_limits<real>::infinity();
+        size_t right_agent = 0;
+        for (size_t curr_agent = 0; curr_agent < seq.size(); ++curr_agent)
+        {
+            while (seq[right_agent % seq.size()] + g.size * (right_agent / seq.size()) - seq[curr_agent] < g.size / 2)
+            {
+                ++right_agent;
+            }
+            if ((right_agent - curr_agent) * 2 - 1 == seq.size() && agentCosts()[curr_agent] < min_cost)
+            {
+                min_cost = agentCosts()[curr_agent];
+                opt = curr_agent;
+            }
+        }
+        return *opt;
+    }
+};
+
+real pcdBoundValue(const Profile &p) {
+    const l<real> &dis_opp = p.oppositeDistances();
+    real optimalCost = sum(dis_opp);
+    real realCost = 2* sum(dis_opp | transform([&](real x) EXPR(x * (1 - x))));
+    return nzero(optimalCost) ? realCost / optimalCost : (nzero(realCost) ? numeric_limits<real>::infinity() : 1);
 }
 
-real getOptCost(const Graph &g, const l<size_t> &seq) {
-    return minimum(seq | transform([&](size_t x) EXPR(getVertexCost(g, seq, x))));
+real pcdBoundValue(const Graph &g, const l<size_t> &seq) EXPR(pcdBoundValue(Profile(g, seq)))
+
+// Lotteries read profiles, so that data derived from them is shared with quantities and
+// filters evaluating the same profile.
+template<typename T>
+using lotteryOf=function<l<T>(const Profile&)>;
+using lottery=lotteryOf<real>;
+using exactLottery=lotteryOf<Rational>;
+
+// Position on circle of length 1 of vertex v of graph of given size, uniform unless
+// positions of vertices are given (only real lotteries support custom positions).
+template<typename T>
+T vertexPosition(size_t v, size_t size, const l<real> &positions) {
+    if constexpr (std::is_same_v<T, real>) {
+        if (!positions.empty()) return positions[v];
+    }
+    return T(v) / T(size);
 }
 
-template<bool normalize = true>
-auto optLottery(const Graph &g) {
-    return [&](const l<size_t> &as) {
-        real minCost = getOptCost(g, as);
-        l<real> res = toVec(as | transform([&](size_t x)EXPR(getVertexCost(g, as, x) == minCost ? 1.0 : 0.0)));
-        if (normalize) {
-            real s = sum(res);
-            for (real &el : res) el /= s;
+// distantBasedLottery for vertices at given positions: ranks are integrated over arc lengths
+// instead of summed over vertices. The integral is not exact but tabulated on 4096 cells
+// with midpoint rule and interpolated linearly between them.
+template<typename F>
+lottery arcDistantBasedLottery(const l<real> &positions, const F &ranks) {
+    constexpr size_t cells = 1 << 12;
+    l<real> integral(cells + 1);
+    for (size_t i = 0; i < cells; ++i) integral[i+1] = integral[i] + ranks((i + 0.5) / cells);
+    const real total = integral.back();
+    for (real &x : integral) x /= total;
+    // normalised integral of ranks over [0, x]
+    auto rankUpTo = [integral](real x) {
+        real c = min(max(x, 0.), 1.) * cells;
+        size_t i = min(size_t(c), cells - 1);
+        return integral[i] + (c - i) * (integral[i+1] - integral[i]);
+    };
+    return [rankUpTo, positions](const Profile &p) {
+        const l<size_t> &as = p.agents();
+        const size_t agentsNum = as.size();
+        const size_t dis = agentsNum / 2;
+        auto pos = [&](size_t i) EXPR(positions[as[i]]);
+        l<real> res{};
+        res.reserve(agentsNum);
+        for (size_t i = 0; i < agentsNum; ++i) {
+            real probability = 0;
+            const size_t scoredRangeStart = (i + dis) % agentsNum;
+            const size_t scoredRangeEnd = (scoredRangeStart + 1) % agentsNum;
+            for (size_t j = 0; j < agentsNum; ++j) {
+                if (scoredRangeStart < j)
+                    probability += rankUpTo(pos(j) - pos(scoredRangeStart)) - rankUpTo(pos(j) - pos(scoredRangeEnd));
+                else if (scoredRangeEnd <= j)
+                    probability += rankUpTo(1 + pos(j) - pos(scoredRangeStart)) - rankUpTo(pos(j) - pos(scoredRangeEnd));
+                else
+                    probability += rankUpTo(pos(scoredRangeEnd) - pos(j)) - rankUpTo(pos(scoredRangeStart) - pos(j));
+            }
+            res.push_back(probability / agentsNum);
         }
         return res;
     };
 }
 
-real approximationRatio(const lottery &lot, const Graph &g, const l<size_t> &seq) {
-    real optimalCost = std::numeric_limits<real>::infinity();
-    real realCost = 0;
-    for (const auto &[a, p] : zip(seq, lot(seq))) {
-        real c = getVertexCost(g, seq, a);
-        realCost += p * c;
-        optimalCost = min(optimalCost, c);
-    }
-    return nzero(optimalCost) ? realCost / optimalCost : (nzero(realCost) ? numeric_limits<real>::infinity() : 1);
-}
-
-class Quantity {
-    public:
-    virtual real score(const l<size_t> &seq, const Graph &g) const = 0;
-    real operator()(const l<size_t> &seq, const Graph &g) const EXPR(score(seq, g));
-};
+// Largest number of agents for which lotteries are compiled for a fixed number of agents.
+constexpr size_t maxSpecializedAgents = 12;
 
-class ApproxRatio : public Quantity {
-    private:
-    const lottery &lot;
-    public:
-    ApproxRatio(const lottery &lot) : lot(lot) {}
-    real score(const l<size_t> &seq, const Graph &g) const override {
-        return approximationRatio(lot, g, seq);
-    }
-};
+// Calls f with std::integral_constant holding agentsNum if it is in [2, maxSpecializedAgents],
+// and holding 0 (number of agents known only at runtime) otherwise.
+template<size_t N = 2, typename F>
+auto withAgentsNum(size_t agentsNum, F &&f) {
+    if constexpr (N > maxSpecializedAgents) return f(std::integral_constant<size_t, 0>{});
+    else if (agentsNum == N) return f(std::integral_constant<size_t, N>{});
+    else return withAgentsNum<N + 1>(agentsNum, std::forward<F>(f));
+}
 
-class PcdBound : public Quantity {
-    public:
-    real score(const l<size_t> &seq, const Graph &g) const override {
-        return pcdBoundValue(g, seq);
+// Probabilities of distantBasedLottery. For Agents > 0 equal to the number of agents, loops
+// have constant bounds, so they are unrolled and indices modulo number of agents fold.
+template<size_t Agents, typename T, typename R>
+l<T> distantBasedProbabilities(const l<size_t> &as, const R &rankOfRange, size_t size, T prefixSum) {
+    const size_t agentsNum = Agents ? Agents : as.size();
+    const size_t dis = agentsNum / 2;
+    l<T> res = VectorPool<T>::take();
+    res.reserve(agentsNum);
+    for (size_t i = 0; i < agentsNum; ++i) {
+        T probability = 0;
+        const size_t scoredRangeStart = (i + dis) % agentsNum;
+        const size_t scoredRangeEnd = (scoredRangeStart + 1) % agentsNum;
+        for (size_t j = 0; j < agentsNum; ++j) {
+            if (scoredRangeStart < j)
+                probability += rankOfRange(as[j] - as[scoredRangeStart], as[j] - as[scoredRangeEnd]);
+            else if (scoredRangeEnd <= j)
+                probability += rankOfRange(size + as[j] - as[scoredRangeStart], as[j] - as[scoredRangeEnd]);
+            else
+                probability += rankOfRange(as[scoredRangeEnd] - as[j], as[scoredRangeStart] - as[j]);
+        }
+        res.push_back(probability / prefixSum / T(agentsNum));
     }
-};
+    return res;
+}
 
-class SumQ : public Quantity {
-    private:
-    unique_ptr<Quantity> q1;
-    unique_ptr<Quantity> q2;
-    public:
-    SumQ(unique_ptr<Quantity> q1, unique_ptr<Quantity> q2) : q1(std::move(q1)), q2(std::move(q2)) {}
-    real score(const l<size_t> &seq, const Graph &g) const override {
-        return (*q1)(seq, g) + (*q2)(seq, g);
+// agentsNum, if given, selects probabilities compiled for that number of agents
+template<typename T = real, typename F>
+lotteryOf<T> distantBasedLottery(size_t size, const F &ranks, const l<real> &positions = {}, size_t agentsNum = 0) {
+    if constexpr (std::is_same_v<T, real>) {
+        if (!positions.empty()) return arcDistantBasedLottery(positions, ranks);
     }
-};
+    vector<T> weights = vector<T>(size+1);
 
-class Filter : public seqs {
-    unique_ptr<seqs> innerGen;
-protected:
-    const Graph &graph;
-public:
-    Filter(unique_ptr<seqs> gen, const Graph &graph) : seqs(0, 0, 0), innerGen(std::move(gen)), graph(graph) {}
-    virtual bool ifSkip(const l<size_t> &seq) const = 0;
-    bool next() override {
-        do {
-            if (!innerGen->next()) return false;
-        } while (ifSkip(get()));
-        return true;
+    // precalculating weight
+    T prefixSum = 0;
+    for (size_t i = 0; i < size; ++i) {
+        if constexpr (std::is_same_v<T, real>) weights[i+1] = prefixSum += ranks((i + 0.5f) / size);
+        else weights[i+1] = prefixSum += ranks(T(2 * i + 1) / T(2 * size));
     }
-    const l<size_t> &get() const override EXPR(innerGen->get())
-    l<size_t> &get() override EXPR(innerGen->get())
-    double approxSize() const override EXPR(innerGen->approxSize());
-};
+    auto rankOfRange = [weights](size_t b, size_t a = 0) EXPR(weights[b] - weights[a]);
+    return withAgentsNum(agentsNum, [&]<size_t Agents>(std::integral_constant<size_t, Agents>) -> lotteryOf<T> {
+        return [rankOfRange, size, prefixSum](const Profile &p) {
+            const l<size_t> &as = p.agents();
+            // profiles of other lengths (e.g. read from stdin) take the generic path
+            if (Agents && as.size() == Agents) return distantBasedProbabilities<Agents>(as, rankOfRange, size, prefixSum);
+            return distantBasedProbabilities<0>(as, rankOfRange, size, prefixSum);
+        };
+    });
+}
 
-bool is_balanced(conf c) {
-    auto [graph_ref, seq_ref] = c;
-    const Graph &graph = graph_ref.get();
-    const l<size_t> &seq = seq_ref.get();
-    const size_t bound = graph.size / 2;
-    for (size_t i = 0; i + 1 < seq.size(); ++i) {
-        if (seq[i + 1] - seq[i] > bound) return false;
-    }
-    return graph.size - seq.front() - seq.back() <= bound;
+template<rn::input_range R>
+vector<rn::range_value_t<R>> toVec(R &&r) {
+    vector<rn::range_value_t<R>> res;
+    if constexpr(rn::sized_range<decltype(r)>) res.reserve(rn::size(r));
+    rn::copy(r, back_inserter(res));
+    return res;
 }
 
-class FilterUnbalanced : public Filter {
-    public:
-    FilterUnbalanced(unique_ptr<seqs> gen, const Graph &graph) : Filter(std::move(gen), graph) {}
-    bool ifSkip(const l<size_t> &seq) const override {
-        return !is_balanced(std::make_pair(std::ref(graph), std::ref(seq)));
-    }
-};
+// Lottery of pcd3 and r3pcd, summing weighted gaps between consecutive agents for every agent.
+// Each weight multiplies the same sum of differences of positions of consecutive agents from
+// the agent on, the one across vertex 0 not wrapped, so weights are summed once and the sums
+// are taken over gaps of the profile in O(n^2).
+template<bool normalize = true, typename T = real>
+lotteryOf<T> gapBasedLottery(size_t size, l<T> weights, const l<real> &positions = {}) {
+    T weightsSum = 0;
+    for (const T &w : weights) weightsSum += w;
+    return [size, weightsSum, positions](const Profile &p) {
+        const l<size_t> &as = p.agents();
+        const size_t agentsNum = as.size();
+        l<T> differences = VectorPool<T>::take();
+        if constexpr (std::is_same_v<T, real>) {
+            differences.assign(p.gaps().begin(), p.gaps().end());
+            differences.back() -= 1;
+        }
+        else {
+            // gaps of the profile are not exact
+            differences.resize(agentsNum);
+            for (size_t i = 0; i < agentsNum; ++i)
+                differences[i] = vertexPosition<T>(as[(i + 1) % agentsNum], size, positions) - vertexPosition<T>(as[i], size, positions);
+        }
+        l<T> res = VectorPool<T>::take();
+        res.resize(agentsNum);
+        for (size_t i = 0; i < agentsNum; ++i) {
+            T total = 0;
+            for (size_t k = i; k < i + agentsNum; ++k) total += differences[k % agentsNum];
+            res[i] = weightsSum * total;
+        }
+        VectorPool<T>::give(std::move(differences));
+        if (normalize) {
+            T s = sum(res);
+            for (T &el : res) el /= s;
+        }
+        return res;
+    };
+}
 
-bool is_nondominant(conf c) {
-    auto [graph_ref, seq_ref] = c;
-    const l<size_t> &seq = seq_ref.get();
-    size_t consecutiveOccurrences = 0;
-    size_t el = 0;
-    for (size_t x : seq) {
-        if (x == el) {
-            if (++consecutiveOccurrences > seq.size() / 2) return false;
-        } else {
-            el = x;
-            consecutiveOccurrences = 1;
+template<bool normalize = true, typename T = real>
+lotteryOf<T> oppositionBasedLottery(size_t size, function<T(T)> weights, const l<real> &positions = {}) {
+    return [size, weights, positions](const Profile &p) {
+        const l<size_t> &as = p.agents();
+        const size_t agentsNum = as.size();
+        const size_t dis = agentsNum / 2;
+        l<T> res = VectorPool<T>::take();
+        res.resize(agentsNum);
+        for (size_t i = 0; i < agentsNum; ++i) {
+            size_t idx1 = (i + dis) % agentsNum;
+            size_t idx2 = (i + dis + 1) % agentsNum;
+            T diff = positions.empty() ? (T(as[idx2]) - T(as[idx1])) / T(size)
+                : vertexPosition<T>(as[idx2], size, positions) - vertexPosition<T>(as[idx1], size, positions);
+            if (i + dis == agentsNum - 1)
+            diff += 1;
+            res[i] = weights(diff);
         }
-    }
-    return true;
+        if (normalize) {
+            T s = sum(res);
+            for (T &el : res) el /= s;
+        }
+        return res;
+    };
 }
 
-class FilterDominant : public Filter {
+auto customLottery(size_t size, const string &path, size_t opt) {
+    std::vector<unsigned long> shape {};
+    std::vector<real> data;
+
+    npy::LoadArrayFromNumpy(path, shape, data);
+    for (auto dim : shape | drop(1) | reverse | drop(1)) {
+        if (dim != size) throw std::runtime_error("custom lottery does not match size of graph: " + path);
+    }
+    return [size, shape, data, opt](const Profile &p) {
+        const l<size_t> &as = p.agents();
+        const size_t agentsNum = as.size();
+        if (agentsNum + 1 != shape.size()) throw std::runtime_error("custom lottery does not match num of agents");
+        size_t start = 0;
+        if (opt >= 1) {
+            for (auto el : as) start = start * size + el - as[0];
+        } else {
+            for (auto el : as) start = start * size + el;
+        }
+        start *= agentsNum;
+        return toVec(data | drop(start) | take(agentsNum));
+    };
+}
+
+template<typename T = real>
+l<T> rdLottery(const Profile &p) {
+    const size_t agentsNum = p.agents().size();
+    l<T> res = VectorPool<T>::take();
+    res.assign(agentsNum, T(1) / T(agentsNum));
+    return res;
+}
+
+template<typename T>
+lotteryOf<T> reversedLottery(size_t size, const lotteryOf<T> &lot) {
+    return [size, lot](const Profile &p) {
+        const l<size_t> reversed = toVec(p.agents() | reverse | transform([size](size_t x)EXPR(size - x)));
+        return toVec(lot(Profile(p.graph(), reversed)) | reverse);
+    };
+}
+
+template<typename T = real>
+lotteryOf<T> mixedLottery(size_t size, T a, const std::type_identity_t<lotteryOf<T>> &lot1, const std::type_identity_t<lotteryOf<T>> &lot2) {
+    return [=](const Profile &p) {
+        auto res = lot1(p);
+        auto tmp = lot2(p);
+        for (size_t i = 0; i < res.size(); ++i) {
+            res[i] = res[i] * a + tmp[i] * (1 - a);
+        }
+        VectorPool<T>::give(std::move(tmp));
+        return res;
+    };
+}
+
+const size_t multipliers[] = {6, 3, 1};
+template<typename T>
+lotteryOf<T> randomizedLottery(const lotteryOf<T> &lot) {
+    return [=](const Profile &p) {
+        const l<size_t> &as = p.agents();
+        l<size_t> as2;
+        l<T> res(as.size(), 0);
+        size_t agents_num = as.size();
+        size_t div = agents_num * agents_num * agents_num;
+        for (size_t i0 = 0; i0 < agents_num; ++i0)
+        {
+            as2.push_back(as[i0]);
+            for (size_t i1 = i0; i1 < agents_num; ++i1)
+            {
+                as2.push_back(as[i1]);
+                for (size_t i2 = i1; i2 < agents_num; ++i2)
+                {
+                    as2.push_back(as[i2]);
+                    size_t eq_num = (i0 == i1) + (i1 == i2);
+                    T mul = T(multipliers[eq_num]);
+                    l<T> innerRes = lot(Profile(p.graph(), as2));
+                    res[i0] += mul * innerRes[0];
+                    res[i1] += mul * innerRes[1];
+                    res[i2] += mul * innerRes[2];
+                    as2.pop_back();
+                }
+                as2.pop_back();
+            }
+            as2.pop_back();
+        }
+        for (auto &el : res) el /= T(div);
+        return res;
+    };
+}
+
+template<typename T>
+lotteryOf<T> randomizedLottery2(const lotteryOf<T> &lot) {
+    return [=](const Profile &p) {
+        const l<size_t> &as = p.agents();
+        l<size_t> as2;
+        l<T> res(as.size(), 0);
+        size_t agents_num = as.size();
+        size_t div = agents_num * (agents_num - 1) * (agents_num - 2) / 6;
+        for (size_t i0 = 0; i0 < agents_num; ++i0)
+        {
+            as2.push_back(as[i0]);
+            for (size_t i1 = i0 + 1; i1 < agents_num; ++i1)
+            {
+                as2.push_back(as[i1]);
+                for (size_t i2 = i1 + 1; i2 < agents_num; ++i2)
+                {
+                    as2.push_back(as[i2]);
+                    l<T> innerRes = lot(Profile(p.graph(), as2));
+                    res[i0] += innerRes[0];
+                    res[i1] += innerRes[1];
+                    res[i2] += innerRes[2];
+                    as2.pop_back();
+                }
+                as2.pop_back();
+            }
+            as2.pop_back();
+        }
+        for (auto &el : res) el /= T(div);
+        return res;
+    };
+}
+
+real getLotteryCost(const lottery &lot, const Graph &g, const l<size_t> &seq) {
+    const Profile profile(g, seq);
+    real realCost = 0;
+    for (const auto &[c, p] : zip(profile.agentCosts(), lot(profile))) realCost += p * c;
+    return realCost;
+}
+
+real getOptCost(const Graph &g, const l<size_t> &seq) {
+    return minimum(g.agentCosts(seq));
+}
+
+template<bool normalize = true>
+auto optLottery(const Graph &g) {
+    return [&](const Profile &p) {
+        // indicators of optimal agents replace costs shared by the profile
+        l<real> res = VectorPool<real>::take();
+        res.assign(p.agentCosts().begin(), p.agentCosts().end());
+        real minCost = minimum(res);
+        for (real &c : res) c = c == minCost ? 1.0 : 0.0;
+        if (normalize) {
+            real s = sum(res);
+            for (real &el : res) el /= s;
+        }
+        return res;
+    };
+}
+
+template<typename T> T parseNumber(const string &val);
+template<> inline real parseNumber(const string &val) EXPR(std::stod(val))
+template<> inline Rational parseNumber(const string &val) EXPR(Rational::parse(val))
+
+// What lotteries are parsed for: size of the circle (differing from size of graph when
+// lotteries are parsed again for other sizes, as by multi-resolution search), number of
+// agents, positions of vertices of custom circles (empty for uniform ones) and the graph.
+struct LotteryContext {
+    size_t graphSize, agentsNum;
+    const l<real> &positions;
+    const Graph &graph;
+};
+
+// Parses method with its parameter from argv, advancing it. Methods are parsed generically
+// over number type T, so that the same arguments may be parsed again into an exact
+// (Rational) counterpart for certified mode.
+template<typename T>
+lotteryOf<T> parseMethod(const char **&argv, const LotteryContext &ctx) {
+    constexpr bool exact = !std::is_same_v<T, real>;
+    auto consume = [&argv](const char *arg) {
+        if (!*argv) throw std::runtime_error(string{"expected parameter: "} + arg);
+        return *argv++;
+    };
+    auto fail = [](const string &reason) { throw std::runtime_error(reason); };
+    const size_t graphSize = ctx.graphSize, agentsNum = ctx.agentsNum;
+    const l<real> &positions = ctx.positions;
+    string method = consume("method");
+    if (method == "rd") return rdLottery<T>;
+    else if (method == "pcd") return distantBasedLottery<T>(graphSize, uniformRank<T>, positions, agentsNum);
+    else if (method == "pcd2") return oppositionBasedLottery<false, T>(graphSize, std::identity(), positions);
+    else if (method == "pcd3") {
+        l<T> weight(agentsNum, T(0));
+        weight[(agentsNum - 1) / 2] = 1;
+        return gapBasedLottery<true, T>(graphSize, weight, positions);
+    }
+    else if (method == "r3pcd") {
+        l<T> weight(agentsNum, T(0));
+        for(size_t i = 0; i < agentsNum; i++) weight[i] = T((1+2*i)*agentsNum) - T(2)/T(3) - T(2*i*(i+1));
+        return gapBasedLottery<true, T>(graphSize, weight, positions);
+    }
+    else if (method == "dbl") {
+        real exponent = std::stod(consume("exponent"));
+        if constexpr (exact) fail("no exact counterpart of method: " + method);
+        else return distantBasedLottery(graphSize, powerRank(exponent), positions, agentsNum);
+    }
+    else if (method == "sqcd") return distantBasedLottery<T>(graphSize, circleRank<T>, positions, agentsNum);
+    else if (method == "qcd") {
+        T bound = parseNumber<T>(consume("exponent"));
+        return oppositionBasedLottery<true, T>(graphSize, [bound](T r) EXPR(max(r * r, bound * bound)), positions);
+    }
+    else if (method == "custom0" || method == "custom1") {
+        string path = consume("path");
+        if constexpr (exact) fail("no exact counterpart of method: " + method);
+        else return customLottery(graphSize, path, method == "custom1");
+    }
+    else if (method == "opt") {
+        if (graphSize != ctx.graph.size) fail("method opt does not support changing graph size");
+        if constexpr (exact) fail("no exact counterpart of method: " + method);
+        else return optLottery(ctx.graph);
+    }
+    fail("unrecognised method: " + method);
+    return {};
+}
+
+// Parses mechanism from argv, advancing it: a method followed by methods mixed into it
+// with given weights (M<weight> method) and randomizations (R<type>). Methods are parsed
+// by parseNext, which wraps parseMethod.
+template<typename T, typename P>
+lotteryOf<T> parseMechanism(const char **&argv, size_t graphSize, P parseNext) {
+    auto flag = [&argv](char symbol) EXPR((*argv && **argv == symbol) ? (*argv++) + 1 : nullptr);
+    lotteryOf<T> lot = parseNext();
+    while (const char *val = flag('M')) lot = mixedLottery<T>(graphSize, parseNumber<T>(val), parseNext(), lot);
+    while (const char *val = flag('R')) {
+        size_t t = std::stoul(val);
+        if (t == 0) lot = randomizedLottery(lot);
+        else if (t == 1) lot = randomizedLottery2(lot);
+        else throw std::runtime_error("unrecognised randomization type: " + string(val));
+    }
+    return lot;
+}
+
+real approximationRatio(const l<real> &probabilities, const Profile &profile) {
+    real optimalCost = std::numeric_limits<real>::infinity();
+    real realCost = 0;
+    for (const auto &[c, p] : zip(profile.agentCosts(), probabilities)) {
+        realCost += p * c;
+        optimalCost = min(optimalCost, c);
+    }
+    return nzero(optimalCost) ? realCost / optimalCost : (nzero(realCost) ? numeric_limits<real>::infinity() : 1);
+}
+
+real approximationRatio(const lottery &lot, const Profile &profile) {
+    l<real> probabilities;
+    {
+        STAGE(lottery);
+        probabilities = lot(profile);
+    }
+    STAGE(cost);
+    real res = approximationRatio(probabilities, profile);
+    VectorPool<real>::give(std::move(probabilities));
+    return res;
+}
+
+real approximationRatio(const lottery &lot, const Graph &g, const l<size_t> &seq) EXPR(approximationRatio(lot, Profile(g, seq)))
+
+class Quantity {
+    public:
+    virtual real score(const Profile &p) const = 0;
+    real operator()(const l<size_t> &seq, const Graph &g) const EXPR(score(Profile(g, seq)));
+};
+
+class ApproxRatio : public Quantity {
+    private:
+    const lottery &lot;
+    public:
+    ApproxRatio(const lottery &lot) : lot(lot) {}
+    real score(const Profile &p) const override {
+        return approximationRatio(lot, p);
+    }
+};
+
+class PcdBound : public Quantity {
+    public:
+    real score(const Profile &p) const override {
+        return pcdBoundValue(p);
+    }
+};
+
+// Sub-quantities are evaluated on the same profile, sharing its derived data.
+class SumQ : public Quantity {
+    private:
+    unique_ptr<Quantity> q1;
+    unique_ptr<Quantity> q2;
+    public:
+    SumQ(unique_ptr<Quantity> q1, unique_ptr<Quantity> q2) : q1(std::move(q1)), q2(std::move(q2)) {}
+    real score(const Profile &p) const override {
+        return q1->score(p) + q2->score(p);
+    }
+};
+
+class Filter : public seqs {
+    unique_ptr<seqs> innerGen;
+    // of the current sequence, unless an inner filter has built it
+    std::optional<Profile> profile;
+protected:
+    const Graph &graph;
+    const seqs &inner() const EXPR(*innerGen)
+public:
+    Filter(unique_ptr<seqs> gen, const Graph &graph) : seqs(0, 0, 0), innerGen(std::move(gen)), graph(graph) {}
+    virtual bool ifSkip(const Profile &p) const = 0;
+    bool next() override {
+        for (;;) {
+            if (!innerGen->next()) return false;
+            STAGE(filtering);
+            if (!innerGen->currentProfile(graph)) profile.emplace(graph, get(), innerGen->knownAgentCosts(graph));
+            if (!ifSkip(*currentProfile(graph))) return true;
+        }
+    }
+    const l<size_t> &get() const override EXPR(innerGen->get())
+    l<size_t> &get() override EXPR(innerGen->get())
+    // at most as many as yielded by the inner generator
+    double approxSize() const override EXPR(innerGen->approxSize());
+    bool boundingSize() const override EXPR(innerGen->boundingSize())
+    size_t rank() const override EXPR(innerGen->rank())
+    size_t rankBound() const override EXPR(innerGen->rankBound())
+    l<size_t> unrank(size_t rank) const override EXPR(innerGen->unrank(rank))
+    void seek(size_t rank) override { innerGen->seek(rank); }
+    const l<real> *knownAgentCosts(const Graph &g) const override EXPR(innerGen->knownAgentCosts(g))
+    const Profile *currentProfile(const Graph &g) const override {
+        if (const Profile *p = innerGen->currentProfile(g)) return p;
+        return profile && &g == &graph ? &*profile : nullptr;
+    }
+};
+
+// Profile of the current sequence of gen on g, shared with filters of gen that have built
+// it, so that data derived from the profile is computed once per sequence.
+class CurrentProfile {
+    std::optional<Profile> own;
+    const Profile *shared;
+public:
+    CurrentProfile(const seqs &gen, const Graph &g) : shared(gen.currentProfile(g)) {
+        if (!shared) own.emplace(g, gen.get(), gen.knownAgentCosts(g));
+    }
+    const Profile &operator*() const EXPR(shared ? *shared : *own)
+};
+
+// Restricts generator to sequences with ranks from [beginRank, endRank).
+class RankRange : public seqs {
+    unique_ptr<seqs> innerGen;
+    size_t beginRank, endRank;
+    // first sequence past the range, ranks follow lexicographic order
+    l<size_t> endSeq;
+    bool covers() const EXPR(beginRank == 0 && endRank == innerGen->rankBound())
+public:
+    RankRange(unique_ptr<seqs> gen, size_t beginRank, size_t endRank) : seqs(0, 0, 0), innerGen(std::move(gen)) {
+        this->endRank = min(endRank, innerGen->rankBound());
+        this->beginRank = min(beginRank, this->endRank);
+        if (this->endRank < innerGen->rankBound()) endSeq = innerGen->unrank(this->endRank);
+        innerGen->seek(this->beginRank);
+    }
+    bool next() override {
+        return innerGen->next() && (endSeq.empty() || rn::lexicographical_compare(innerGen->get(), endSeq));
+    }
+    const l<size_t> &get() const override EXPR(innerGen->get())
+    l<size_t> &get() override EXPR(innerGen->get())
+    // every rank of a space without the mirror restriction is a sequence, otherwise about
+    // the same fraction of ranks is yielded in the range as in the whole space
+    double approxSize() const override {
+        if (covers()) return innerGen->approxSize();
+        std::optional<SeqSpace> innerSpace = innerGen->space();
+        if (innerSpace && !innerSpace->asymmetric) return endRank - beginRank;
+        return innerGen->approxSize() * (endRank - beginRank) / innerGen->rankBound();
+    }
+    bool exactSize() const override {
+        if (covers()) return innerGen->exactSize();
+        std::optional<SeqSpace> innerSpace = innerGen->space();
+        return innerSpace && !innerSpace->asymmetric;
+    }
+    // the proportional share of a partial range may fall short of what it yields
+    bool boundingSize() const override EXPR(covers() && innerGen->boundingSize())
+    // a range of all ranks yields the space of the inner generator, so that it is counted
+    // exactly also by filters
+    std::optional<SeqSpace> space() const override EXPR(covers() ? innerGen->space() : std::nullopt)
+    size_t rank() const override EXPR(innerGen->rank())
+    size_t rankBound() const override EXPR(innerGen->rankBound())
+    l<size_t> unrank(size_t rank) const override EXPR(innerGen->unrank(rank))
+    void seek(size_t rank) override { innerGen->seek(max(rank, beginRank)); }
+};
+
+bool is_balanced(conf c) {
+    auto [graph_ref, seq_ref] = c;
+    const Graph &graph = graph_ref.get();
+    const l<size_t> &seq = seq_ref.get();
+    const size_t bound = graph.size / 2;
+    for (size_t i = 0; i + 1 < seq.size(); ++i) {
+        if (seq[i + 1] - seq[i] > bound) return false;
+    }
+    return graph.size - seq.front() - seq.back() <= bound;
+}
+
+class FilterUnbalanced : public Filter {
+    public:
+    FilterUnbalanced(unique_ptr<seqs> gen, const Graph &graph) : Filter(std::move(gen), graph) {}
+    bool ifSkip(const Profile &p) const override {
+        return !is_balanced(std::make_pair(std::ref(graph), std::ref(p.agents())));
+    }
+    double approxSize() const override {
+        std::optional<SeqSpace> innerSpace = inner().space();
+        if (!innerSpace) return Filter::approxSize();
+        innerSpace->balanced = true;
+        return innerSpace->count();
+    }
+    bool exactSize() const override EXPR(inner().space().has_value())
+};
+
+bool is_nondominant(conf c) {
+    auto [graph_ref, seq_ref] = c;
+    const l<size_t> &seq = seq_ref.get();
+    size_t consecutiveOccurrences = 0;
+    size_t el = 0;
+    for (size_t x : seq) {
+        if (x == el) {
+            if (++consecutiveOccurrences > seq.size() / 2) return false;
+        } else {
+            el = x;
+            consecutiveOccurrences = 1;
+        }
+    }
+    return true;
+}
+
+class FilterDominant : public Filter {
     public:
     FilterDominant(unique_ptr<seqs> gen, const Graph &graph) : Filter(std::move(gen), graph) {}
-    bool ifSkip(const l<size_t> &seq) const override {
-        return is_nondominant(std::make_pair(std::ref(graph), std::ref(seq)));
+    bool ifSkip(const Profile &p) const override {
+        return is_nondominant(std::make_pair(std::ref(graph), std::ref(p.agents())));
+    }
+    double approxSize() const override {
+        std::optional<SeqSpace> innerSpace = inner().space();
+        if (!innerSpace) return Filter::approxSize();
+        innerSpace->dominant = true;
+        return innerSpace->count();
+    }
+    bool exactSize() const override EXPR(inner().space().has_value())
+};
+
+// Increasing sequences restricted during generation to balanced ones (no gap, including
+// the one closing the circle, longer than half of it) and/or dominant ones (more than
+// half of agents on one vertex), i.e. those kept by FilterUnbalanced and FilterDominant.
+// Prefixes which cannot be completed are never extended.
+class constrained_seqs : public seqs {
+    bool balanced, dominant;
+    // longest allowed gap
+    size_t halfSize() const EXPR((end - start) / 2)
+    // whether prefix extended by value can still be completed
+    bool allowed(const l<size_t> &prefix, size_t value) const {
+        const size_t remaining = size - prefix.size() - 1;
+        if (balanced) {
+            if (value - prefix.back() > halfSize()) return false;
+            if (value - start + remaining * halfSize() + halfSize() < end - start) return false;
+        }
+        if (dominant) {
+            size_t run = 1, longestRun = 1;
+            for (size_t i = 1; i < prefix.size(); ++i) {
+                run = prefix[i] == prefix[i - 1] ? run + 1 : 1;
+                longestRun = max(longestRun, run);
+            }
+            if (longestRun <= size / 2) {
+                run = prefix.back() == value ? run + 1 : 1;
+                if (run + remaining <= size / 2) return false;
+            }
+        }
+        return true;
+    }
+    // replaces last element by the next allowed value, dropping exhausted elements
+    bool step() {
+        l<size_t> &seq = get();
+        while (seq.size() > 1) {
+            size_t value = seq.back() + 1;
+            seq.pop_back();
+            while (value < end && !allowed(seq, value)) ++value;
+            if (value < end) {
+                seq.push_back(value);
+                return true;
+            }
+        }
+        return false;
+    }
+public:
+    constrained_seqs(size_t start, size_t end, size_t size, bool balanced, bool dominant)
+    : seqs(start, end, size), balanced(balanced), dominant(dominant) {}
+    bool next() override {
+        l<size_t> &seq = get();
+        if (seq.size() == 1 && seq.front() == start - 1) {
+            seq.front() = start;
+            // a single agent leaves gap of the whole circle
+            if (size == 1 && balanced && halfSize() < end - start) return false;
+        }
+        else if (!step()) return false;
+        for (;;) {
+            while (seq.size() < size) {
+                size_t value = seq.back();
+                while (value < end && !allowed(seq, value)) ++value;
+                if (value == end) break;
+                seq.push_back(value);
+            }
+            if (seq.size() == size) return true;
+            if (!step()) return false;
+        }
+    }
+    double approxSize() const override EXPR(space()->count());
+    std::optional<SeqSpace> space() const override EXPR((SeqSpace{end - start, size, 0, false, balanced, dominant}))
+};
+
+size_t get_opt_agent(conf c) EXPR(Profile(c).optAgent())
+
+bool is_agent_middle(size_t curr_agent, conf c)
+{
+    auto [graph_ref, seq_ref] = c;
+    const l<size_t> &seq = seq_ref.get();
+    const Graph &graph = graph_ref.get();
+    size_t right_agent = curr_agent;
+    while (seq[right_agent % seq.size()] + graph.size * (right_agent / seq.size()) - seq[curr_agent] < graph.size / 2.0) ++right_agent;
+    return (right_agent - curr_agent) * 2 - 1 == seq.size();
+}
+
+bool is_0_opt(conf c)
+{
+    /* There may be more then one optimal point.
+    // We use the fact that in such case 0 would be selected by get_opt_agent
+    // as the first optimal point.
+    */
+    return get_opt_agent(c) == 0;
+}
+
+real get_centrality(const Profile &p, size_t span)
+{
+    const Graph &graph = p.graph();
+    const l<size_t> &seq = p.agents();
+    size_t center = p.optAgent();
+    real sum_of_central_distances = 0;
+    for (size_t i = center + seq.size() - span; i <= center + seq.size() + span; ++i)
+    {
+        sum_of_central_distances += graph.distance(seq[i % seq.size()], seq[center]);
+    }
+    real sum_of_other_distances = 0;
+    for (size_t i = center + span + 1; i < center + seq.size() - span; ++i)
+    {
+        sum_of_other_distances += graph.distance(seq[i % seq.size()], seq[center]);
+    }
+    real centrality = sum_of_other_distances / sum_of_central_distances;
+    return centrality;
+}
+
+real get_centrality(conf c, size_t span) EXPR(get_centrality(Profile(c), span))
+
+std::function<bool(conf)> get_centrality_filter(real threshold, size_t span)
+{
+    return [=](conf c) EXPR(get_centrality(c, span) >= threshold);
+}
+
+bool is_sparse(real threshold, const Profile &p)
+{
+    real min_distance = minimum(p.oppositeDistances());
+    return min_distance >= threshold;
+}
+
+bool is_sparse(real threshold, conf c) EXPR(is_sparse(threshold, Profile(c)))
+
+std::function<bool(conf)> get_sparse_filter(real threshold)
+{
+    return [=](conf c) EXPR(is_sparse(threshold, c));
+}
+
+std::function<bool(conf)> negate(std::function<bool(conf)> f)
+{
+    return [=](conf c) EXPR(!f(c));
+}
+
+std::function<bool(conf)> skip(bool cond, std::function<bool(conf)> f)
+{
+    return cond ? [](conf) EXPR(true) : f;
+}
+
+// Predicate of FilterPipeline keeping profiles for which it holds.
+struct ProfilePredicate {
+    string name;
+    // predicates of lower cost are evaluated first
+    int cost = 0;
+    function<bool(const Profile &)> keep;
+    // constraint of SeqSpace equivalent to the predicate (or to its negation if negated),
+    // so that kept sequences can be counted without evaluating it
+    enum class Constraint { none, balanced, dominant } constraint = Constraint::none;
+    bool negated = false;
+    size_t evaluated = 0;
+    size_t passed = 0;
+    double seconds = 0;
+};
+
+ProfilePredicate balancedPredicate() {
+    return {"balanced", 0, [](const Profile &p) EXPR(is_balanced({p.graph(), p.agents()})),
+        ProfilePredicate::Constraint::balanced};
+}
+ProfilePredicate dominantPredicate() {
+    return {"dominant", 0, [](const Profile &p) EXPR(!is_nondominant({p.graph(), p.agents()})),
+        ProfilePredicate::Constraint::dominant};
+}
+string formatReal(real x) {
+    std::ostringstream os;
+    os << x;
+    return os.str();
+}
+
+ProfilePredicate sparsePredicate(real threshold) {
+    return {"sparse " + formatReal(threshold), 1, [threshold](const Profile &p) EXPR(is_sparse(threshold, p))};
+}
+// both need agent costs, shared through the profile
+ProfilePredicate zeroOptPredicate() {
+    return {"0 optimal", 2, [](const Profile &p) EXPR(p.optAgent() == 0)};
+}
+ProfilePredicate centralityPredicate(real threshold, size_t span) {
+    return {"centrality " + formatReal(threshold) + "/" + std::to_string(span), 2,
+        [threshold, span](const Profile &p) EXPR(get_centrality(p, span) >= threshold)};
+}
+ProfilePredicate negated(ProfilePredicate pred) {
+    pred.name = "not " + pred.name;
+    pred.negated = !pred.negated;
+    pred.keep = [keep = pred.keep](const Profile &p) EXPR(!keep(p));
+    return pred;
+}
+
+// Keeps sequences satisfying all predicates. Predicates are evaluated cheapest first on
+// a single Profile, stopping at the first failing one, and collect their selectivity and time.
+class FilterPipeline : public Filter {
+    mutable l<ProfilePredicate> predicates;
+public:
+    FilterPipeline(unique_ptr<seqs> gen, const Graph &graph, l<ProfilePredicate> preds)
+    : Filter(std::move(gen), graph), predicates(std::move(preds)) {
+        rn::stable_sort(predicates, {}, &ProfilePredicate::cost);
+    }
+    bool ifSkip(const Profile &p) const override {
+        for (ProfilePredicate &pred : predicates) {
+            auto startTime = std::chrono::steady_clock::now();
+            bool keep = pred.keep(p);
+            pred.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+            ++pred.evaluated;
+            if (!keep) return true;
+            ++pred.passed;
+        }
+        return false;
+    }
+    // Exact if the inner space is known and all predicates are balance or dominance (by
+    // inclusion-exclusion over negated ones), otherwise the number of sequences satisfying
+    // those of them bounds it from above.
+    double approxSize() const override {
+        std::optional<SeqSpace> required = inner().space();
+        if (!required) return Filter::approxSize();
+        bool forbidBalanced = false, forbidDominant = false;
+        for (const ProfilePredicate &pred : predicates) {
+            if (pred.constraint == ProfilePredicate::Constraint::balanced) (pred.negated ? forbidBalanced : required->balanced) = true;
+            else if (pred.constraint == ProfilePredicate::Constraint::dominant) (pred.negated ? forbidDominant : required->dominant) = true;
+        }
+        double res = 0;
+        for (bool balanced : {false, true}) {
+            for (bool dominant : {false, true}) {
+                if ((balanced && !forbidBalanced) || (dominant && !forbidDominant)) continue;
+                SeqSpace excluded = *required;
+                excluded.balanced |= balanced;
+                excluded.dominant |= dominant;
+                res += (balanced != dominant ? -1 : 1) * excluded.count();
+            }
+        }
+        return res;
+    }
+    bool exactSize() const override {
+        return inner().space() && rn::all_of(predicates, [](const ProfilePredicate &pred)
+            EXPR(pred.constraint != ProfilePredicate::Constraint::none));
+    }
+    void printStats(std::ostream &os) const {
+        os << "filter\tevaluated\tpassed\tseconds\n";
+        for (const ProfilePredicate &pred : predicates) {
+            os << pred.name << '\t' << pred.evaluated << '\t' << pred.passed << '\t'
+                << setprecision(2) << scientific << pred.seconds << std::defaultfloat << '\n';
+        }
+    }
+};
+
+// Ranks splitting sequences yielded by gen and kept by predicates into shards of about equal
+// numbers of them, shard i spanning ranks from boundary i to boundary i + 1. Skipped sequences
+// (mirrored or filtered ones) are spread over ranks unevenly and most predicates cannot be
+// counted by SeqSpace, so boundaries are quantiles of ranks kept among all ranks of a small
+// space or among a sample of a large one. The sample is seeded by the space only, so that all
+// shards of a run agree on boundaries.
+l<size_t> shardBoundaries(const seqs &gen, const Graph &g, const l<ProfilePredicate> &predicates, size_t shards) {
+    constexpr size_t maxDraws = 1 << 16;
+    const size_t total = gen.rankBound();
+    auto kept = [&](const l<size_t> &seq) {
+        if (!gen.yields(seq)) return false;
+        const Profile p(g, seq);
+        return rn::all_of(predicates, [&](const ProfilePredicate &pred) EXPR(pred.keep(p)));
+    };
+    // when every rank is yielded, evenly split ranks are exact
+    const bool dense = predicates.empty() && gen.exactSize() && gen.approxSize() == double(total);
+    l<size_t> ranks;
+    if (dense) {}
+    else if (total <= maxDraws) {
+        for (size_t rank = 0; rank < total; ++rank) if (kept(gen.unrank(rank))) ranks.push_back(rank);
+    }
+    else {
+        std::mt19937_64 rng(total);
+        for (size_t i = 0; i < maxDraws; ++i) {
+            // the bias of modulo is negligible for spaces this large
+            const size_t rank = rng() % total;
+            if (kept(gen.unrank(rank))) ranks.push_back(rank);
+        }
+        rn::sort(ranks);
+    }
+    l<size_t> res(shards + 1, total);
+    for (size_t i = 0; i < shards; ++i) {
+        // ranks are split evenly without overflowing total * i
+        if (ranks.empty()) res[i] = total / shards * i + total % shards * i / shards;
+        else res[i] = i ? ranks[ranks.size() * i / shards] : 0;
+    }
+    return res;
+}
+
+// Sequences with the agent of seq at given index (the first one by default) moved to each
+// other vertex up to last, kept sorted. They are produced in place, in storage taken from
+// VectorPool.
+class agent1_changes {
+    l<size_t> seq;
+    size_t last, skipped;
+    l<size_t>::iterator elIter;
+    bool advance() {
+        STAGE(deviations);
+        if (++*elIter == skipped) ++*elIter;
+        if (*elIter > last) return false;
+        while(next(elIter) != seq.end() && *elIter > *next(elIter)) {
+            std::iter_swap(elIter, next(elIter));
+            ++elIter;
+        }
+        return true;
+    }
+public:
+    agent1_changes(const l<size_t> &base, size_t last, size_t agent = 0)
+    : seq(VectorPool<size_t>::take()), last(last), skipped(base[agent]) {
+        seq.assign(base.begin(), base.end());
+        // the agent is moved to the front, before vertex 0, from where it advances
+        std::rotate(seq.begin(), seq.begin() + agent, seq.begin() + agent + 1);
+        seq.front() = numeric_limits<size_t>::max();
+    }
+    agent1_changes(const agent1_changes &) = delete;
+    ~agent1_changes() { VectorPool<size_t>::give(std::move(seq)); }
+    class iterator {
+        agent1_changes *changes;
+        bool valid;
+    public:
+        iterator(agent1_changes *changes, bool valid) : changes(changes), valid(valid) {}
+        const l<size_t> &operator*() const EXPR(changes->seq)
+        iterator &operator++() {
+            valid = changes->advance();
+            return *this;
+        }
+        bool operator!=(std::default_sentinel_t) const EXPR(valid)
+    };
+    iterator begin() {
+        elIter = seq.begin();
+        return {this, advance()};
+    }
+    std::default_sentinel_t end() const EXPR(std::default_sentinel)
+};
+
+enum class Verbosity { none, answer, summary, all };
+
+// Outcome of a task, reported alongside the printed output.
+struct Result {
+    real answer = 0;
+    l<size_t> worstSeq{};
+    size_t sequencesNum = 0;
+    // Aggregates from which results of disjoint parts of the space are merged (see mergeShards):
+    // minimal penalty (check), maximal ratio (score) or maximal rd value (rd ratio), sum of
+    // ratios (score) and base cost with penalties of the worst sequence (check).
+    real extremum = 0;
+    real sum = 0;
+    real worstBaseCost = 0;
+    l<real> worstPenalties{};
+};
+
+template<rn::input_range R>
+real cost(size_t a, R && bs, const l<real> &ps, const Graph &g) {
+    return inner_product(bs.begin(), bs.end(), ps.begin(), 0., plus<>(),
+        [&a, &g](size_t b, real p) EXPR(g.distance(a, b) * p));
+}
+
+real lotteryCost(size_t a, const Profile &p, const lottery &lot) {
+    l<real> ps;
+    {
+        STAGE(lottery);
+        ps = lot(p);
+    }
+    STAGE(cost);
+    real res = cost(a, p.agents(), ps, p.graph());
+    VectorPool<real>::give(std::move(ps));
+    return res;
+}
+
+real lotteryCost(size_t a, const l<size_t> &bs, const Graph &g, const lottery &lot) EXPR(lotteryCost(a, Profile(g, bs), lot))
+
+// Indices of agents of seq whose deviations are checked on g: the one at vertex 0 if g is
+// anchored, otherwise the first agent at each occupied vertex (agents on one vertex are
+// interchangeable).
+auto deviatingAgents(const l<size_t> &seq, const Graph &g) {
+    return std::views::iota(size_t(0), g.anchored() ? size_t(1) : seq.size())
+        | std::views::filter([&seq](size_t i) EXPR(i == 0 || seq[i] != seq[i - 1]));
+}
+
+// Profiles of anchored graphs are printed without their vertex 0.
+void printProfile(const l<size_t> &seq, bool anchored) {
+    printR(seq | drop(anchored ? 1 : 0));
+}
+
+// base cost is that of the first agent, penalties those of deviations of each deviating agent in turn
+void printCheckLine(const l<size_t> &seq, real base_cost, const l<real> &penalties, bool anchored = true) {
+    STAGE(output);
+    printProfile(seq, anchored);
+    cout << "|\t" << r(base_cost) << '\t';
+    printR(penalties | transform([](real p)EXPR(r(p))));
+    cout << '\n';
+}
+
+void printScoreLine(const l<size_t> &seq, real approx, bool anchored = true) {
+    STAGE(output);
+    printProfile(seq, anchored);
+    cout << "|\t" << r(approx) << '\n';
+}
+
+// Minimal change of cost of a deviating agent (see deviatingAgents) over all its deviations
+// (negative one refutes strategyproofness).
+real worstPenalty(const lottery &lot, const Graph &g, const l<size_t> &seq) {
+    real minimalPenalty = numeric_limits<real>::infinity();
+    for (size_t agent : deviatingAgents(seq, g)) {
+        const size_t x = seq[agent];
+        const real baseCost = lotteryCost(x, seq, g, lot);
+        for (const auto &seq2 : agent1_changes(seq, g.size - 1, agent))
+            minimalPenalty = min(minimalPenalty, lotteryCost(x, seq2, g, lot) - baseCost);
+    }
+    return minimalPenalty;
+}
+
+void printCheckResult(const Result &res, Verbosity verbosity, bool anchored = true) {
+    if (verbosity == Verbosity::summary) {
+        cout << "strategyproof: " << (res.answer ? "yes" : "no") << '\n';
+        printCheckLine(res.worstSeq, res.worstBaseCost, res.worstPenalties, anchored);
+    } else if (verbosity == Verbosity::answer) cout << bool(res.answer);
+}
+
+Result check(lottery lot, seqs &gen, const Graph &g, Verbosity verbosity) {
+    STAGE_TASK(other);
+    auto printLine = printCheckLine;
+    size_t sequencesNum = 0;
+    real minimalPenalty = numeric_limits<real>::infinity();
+    l<size_t> worstSeq;
+    real associatedBaseCost = 0;
+    l<real> associatedPenalties;
+    // reused between sequences, as is storage of worstSeq and associatedPenalties
+    l<real> penalties;
+    penalties.reserve(g.size - 1);
+
+    if (verbosity >= Verbosity::summary) cerr  << setprecision(2) << scientific << "estimated num of sequences: " << gen.approxSize() << '\n';
+    for (const l<size_t> &seq : gen.toGen()) {
+        ++sequencesNum;
+        const CurrentProfile profile(gen, g);
+        real base_cost = lotteryCost(seq[0], *profile, lot);
+        penalties.clear();
+        for (size_t agent : deviatingAgents(seq, g)) {
+            const size_t x = seq[agent];
+            const real agentCost = agent ? lotteryCost(x, *profile, lot) : base_cost;
+            for (const auto &seq2 : agent1_changes(seq, g.size - 1, agent)) {
+                penalties.push_back(lotteryCost(x, seq2, g, lot) - agentCost);
+            }
+        }
+        real tmp = minimum(penalties);
+        // ties go to the lexicographically first sequence, whatever the order of enumeration
+        if(tmp < minimalPenalty || (tmp == minimalPenalty && seq < worstSeq)) {
+            minimalPenalty = tmp;
+            worstSeq = seq;
+            associatedBaseCost = base_cost;
+            associatedPenalties = penalties;
+        }
+        if (verbosity == Verbosity::all) printLine(seq, base_cost, penalties, g.anchored());
+    }
+    Result res{real(minimalPenalty >= -EPS), worstSeq, sequencesNum, minimalPenalty, 0, associatedBaseCost, associatedPenalties};
+    printCheckResult(res, verbosity, g.anchored());
+    if (verbosity >= Verbosity::summary) STAGE_PRINT(cerr);
+    return res;
+}
+
+void printRdResult(const Result &res, Verbosity verbosity) {
+    if (verbosity >= Verbosity::summary) {
+        cout << "rd ratio: " << r(res.answer) << '\n';
+    } else if (verbosity == Verbosity::answer) cout << r(res.answer);
+}
+
+Result rdRatio(lottery lot, seqs &gen, const Graph &g, Verbosity verbosity) {
+    STAGE_TASK(other);
+    size_t sequencesNum = 0;
+    real rdVal = 0;
+    l<size_t> worstSeq;
+
+    for (const l<size_t> &seq : gen.toGen()) {
+        ++sequencesNum;
+        const CurrentProfile profile(gen, g);
+        for (size_t agent : deviatingAgents(seq, g)) {
+            const size_t x = seq[agent];
+            real baseCost = lotteryCost(x, *profile, lot);
+            real baseRdCost = lotteryCost(x, *profile, rdLottery<>);
+            for (const auto &seq2 : agent1_changes(seq, g.size - 1, agent)) {
+                real penalty = lotteryCost(x, seq2, g, lot) - baseCost;
+                if (penalty < -EPS) {
+                    real val = penalty / (baseRdCost - lotteryCost(x, seq2, g, rdLottery<>));
+                    if (val > rdVal) {
+                        rdVal = val;
+                        worstSeq = seq;
+                    }
+                }
+            }
+        }
+    }
+    Result res{rdVal / (1 + rdVal), worstSeq, sequencesNum, rdVal};
+    printRdResult(res, verbosity);
+    if (verbosity >= Verbosity::summary) STAGE_PRINT(cerr);
+    return res;
+}
+
+size_t distinctValues(const l<size_t> &seq) {
+    size_t res = !seq.empty();
+    for (size_t i = 1; i < seq.size(); ++i) {
+        if (seq[i] != seq[i - 1]) ++res;
+    }
+    return res;
+}
+
+// Sets answer of score from its aggregates and prints it.
+void printScoreResult(Result &res, Verbosity verbosity, bool avg, bool distinctNum, bool anchored = true) {
+    real averageApproximationRatio = res.sum / res.sequencesNum;
+    res.answer = avg ? averageApproximationRatio : res.extremum;
+    // assign number of disctinct values in the worst sequence to result
+    if (distinctNum) res.answer = distinctValues(res.worstSeq);
+    if (verbosity >= Verbosity::summary) {
+        cout << "----------------------------------------" << '\n';
+        cout << "number of processed sequences: " << res.sequencesNum << '\n';
+        cout << "approximation ratio: " << r(res.answer) << '\n';
+        printScoreLine(res.worstSeq, res.extremum, anchored);
+    }
+    else if (verbosity == Verbosity::answer)
+        cout << r(res.answer);
+}
+
+Result score(const Quantity &scorer, seqs &gen, const Graph &g, Verbosity verbosity, bool avg = false, bool distinctNum = false)
+{
+    STAGE_TASK(other);
+    auto printLine = printScoreLine;
+    size_t sequencesNum = 0;
+    real globalApproximationRatio = 0;
+    real approximationRatioSum = 0;
+    l<size_t> worstSeq;
+    if (verbosity >= Verbosity::summary) cerr  << setprecision(2) << scientific << "estimated num of sequences: " << gen.approxSize() << '\n';
+    for (const l<size_t> &seq : gen.toGen()) {
+        ++sequencesNum;
+        const real approx = scorer.score(*CurrentProfile(gen, g));
+        // ties go to the lexicographically first sequence, whatever the order of enumeration
+        if (approx > globalApproximationRatio || (approx == globalApproximationRatio && seq < worstSeq))
+        {
+            globalApproximationRatio = approx;
+            worstSeq = seq;
+        }
+        approximationRatioSum += approx;
+        if (verbosity == Verbosity::all) printLine(seq, approx, g.anchored());
+    }
+    Result res{0, worstSeq, sequencesNum, globalApproximationRatio, approximationRatioSum};
+    printScoreResult(res, verbosity, avg, distinctNum, g.anchored());
+    if (verbosity >= Verbosity::summary) STAGE_PRINT(cerr);
+    return res;
+}
+
+// Partial result of check, score or rd ratio over a shard (a rank range) of the space, written
+// by H<i>/<k> runs. Shards of one run are combined by mergeShards into output of a single run.
+struct Shard {
+    enum class Task { check, score, rd };
+    Task task = Task::check;
+    Verbosity verbosity = Verbosity::summary;
+    // answer of score is average approximation ratio or number of distinct points in the worst sequence
+    bool avg = false;
+    bool distinctNum = false;
+    // whether sequences are printed without vertex 0 (see Graph::anchored)
+    bool anchored = true;
+    Result result;
+};
+
+// Line based text format of results (but their answers), reals in hexadecimal so that they
+// are read back exactly.
+void writeResult(std::ostream &os, const Result &res) {
+    os << std::hexfloat << "sequences " << res.sequencesNum << '\n'
+        << "extremum " << res.extremum << '\n'
+        << "sum " << res.sum << '\n'
+        << "baseCost " << res.worstBaseCost << '\n'
+        << "worst " << res.worstSeq.size();
+    for (size_t x : res.worstSeq) os << ' ' << x;
+    os << "\npenalties " << res.worstPenalties.size();
+    for (real x : res.worstPenalties) os << ' ' << x;
+    os << '\n' << std::defaultfloat;
+}
+
+// Reads result written by writeResult, throws if it is malformed.
+Result readResult(std::istream &in) {
+    auto fail = []() { throw std::runtime_error("malformed result"); };
+    auto expect = [&](const char *key) {
+        string word;
+        if (!(in >> word) || word != key) fail();
+    };
+    // hexadecimal reals are not parsed by streams
+    auto readReal = [&]() {
+        string word;
+        if (!(in >> word)) fail();
+        char *end;
+        real res = std::strtod(word.c_str(), &end);
+        if (*end) fail();
+        return res;
+    };
+    Result r;
+    size_t num;
+    expect("sequences");
+    if (!(in >> r.sequencesNum)) fail();
+    expect("extremum");
+    r.extremum = readReal();
+    expect("sum");
+    r.sum = readReal();
+    expect("baseCost");
+    r.worstBaseCost = readReal();
+    expect("worst");
+    if (!(in >> num)) fail();
+    r.worstSeq.resize(num);
+    for (size_t &x : r.worstSeq) if (!(in >> x)) fail();
+    expect("penalties");
+    if (!(in >> num)) fail();
+    r.worstPenalties.resize(num);
+    for (real &x : r.worstPenalties) x = readReal();
+    return r;
+}
+
+void writeShard(std::ostream &os, const Shard &shard) {
+    os << "shard " << int(shard.task) << ' ' << int(shard.verbosity) << ' ' << shard.avg << ' ' << shard.distinctNum << ' '
+        << shard.anchored << '\n';
+    writeResult(os, shard.result);
+}
+
+Shard readShard(const string &path) {
+    std::ifstream in(path);
+    if (!in) throw std::runtime_error("cannot open shard: " + path);
+    auto fail = [&path]() { throw std::runtime_error("malformed shard: " + path); };
+    Shard res;
+    int task, verbosity;
+    string word;
+    if (!(in >> word >> task >> verbosity >> res.avg >> res.distinctNum >> res.anchored) || word != "shard" || task < 0 || task > int(Shard::Task::rd))
+        fail();
+    try {
+        res.result = readResult(in);
+    } catch (const std::runtime_error &) {
+        fail();
+    }
+    res.task = Shard::Task(task);
+    res.verbosity = Verbosity(verbosity);
+    return res;
+}
+
+// Combines shards of one run as if their sequences were processed by a single run. The worst
+// sequence is chosen as there (ties go to the lexicographically first one), while the sum of
+// ratios is summed in a different order, so an average may differ in the last bits.
+Shard mergeShards(const l<Shard> &shards) {
+    if (shards.empty()) throw std::runtime_error("no shards to merge");
+    Shard res = shards.front();
+    Result &m = res.result;
+    m = Result{};
+    if (res.task == Shard::Task::check) m.extremum = numeric_limits<real>::infinity();
+    for (const Shard &shard : shards) {
+        if (shard.task != res.task || shard.verbosity != res.verbosity || shard.avg != res.avg || shard.distinctNum != res.distinctNum
+            || shard.anchored != res.anchored)
+            throw std::runtime_error("shards of different runs");
+        const Result &r = shard.result;
+        m.sequencesNum += r.sequencesNum;
+        m.sum += r.sum;
+        const bool better = res.task == Shard::Task::check ? r.extremum < m.extremum : r.extremum > m.extremum;
+        if (better || (r.extremum == m.extremum && !r.worstSeq.empty() && r.worstSeq < m.worstSeq)) {
+            m.extremum = r.extremum;
+            m.worstSeq = r.worstSeq;
+            m.worstBaseCost = r.worstBaseCost;
+            m.worstPenalties = r.worstPenalties;
+        }
+    }
+    return res;
+}
+
+// Prints result of (merged) shard as the run processing all of them would.
+void printShard(Shard &shard) {
+    Result &res = shard.result;
+    switch (shard.task) {
+        case Shard::Task::check:
+            res.answer = res.extremum >= -EPS;
+            printCheckResult(res, shard.verbosity, shard.anchored);
+            break;
+        case Shard::Task::score:
+            printScoreResult(res, shard.verbosity, shard.avg, shard.distinctNum, shard.anchored);
+            break;
+        case Shard::Task::rd:
+            res.answer = res.extremum / (1 + res.extremum);
+            printRdResult(res, shard.verbosity);
+            break;
+    }
+}
+
+// Selection of tasks evaluated together by combinedTasks.
+struct Tasks {
+    bool check = false;
+    bool score = false;
+    bool rd = false;
+    // answer of score is average approximation ratio or number of distinct points in the worst sequence
+    bool avg = false;
+    bool distinctNum = false;
+};
+
+// Results of tasks of a single lottery accumulated by combinedTasks.
+struct TasksState {
+    real minimalPenalty = numeric_limits<real>::infinity();
+    l<size_t> checkWorstSeq;
+    real associatedBaseCost = 0;
+    l<real> associatedPenalties;
+    real worstRatio = 0;
+    real ratioSum = 0;
+    l<size_t> ratioWorstSeq;
+    real rdVal = 0;
+    l<size_t> rdWorstSeq;
+    // values of the current sequence
+    real baseCost = 0;
+    real ratio = 0;
+    real rd = 0;
+    l<real> penalties;
+    // cost of the deviating agent
+    real agentCost = 0;
+};
+
+// Performs selected tasks for all lotteries in a single pass over gen. Profile data (agent
+// costs), deviations of agents and their rd costs are shared by all lotteries, and
+// every lottery is evaluated once per sequence and deviation. With a single lottery summary
+// lists the results of check, score and rdRatio in this order, otherwise one row per lottery.
+Result combinedTasks(const l<lottery> &lots, const l<string> &names, seqs &gen, const Graph &g,
+    Verbosity verbosity, Tasks tasks)
+{
+    size_t sequencesNum = 0;
+    l<TasksState> states(lots.size());
+
+    if (verbosity >= Verbosity::summary) cerr  << setprecision(2) << scientific << "estimated num of sequences: " << gen.approxSize() << '\n';
+    for (const l<size_t> &seq : gen.toGen()) {
+        ++sequencesNum;
+        const CurrentProfile current(gen, g);
+        const Profile &profile = *current;
+        for (size_t k = 0; k < lots.size(); ++k) {
+            TasksState &st = states[k];
+            l<real> probabilities = lots[k](profile);
+            st.baseCost = cost(seq[0], seq, probabilities, g);
+            if (tasks.score) {
+                st.ratio = approximationRatio(probabilities, profile);
+                st.ratioSum += st.ratio;
+                if (st.ratio > st.worstRatio) {
+                    st.worstRatio = st.ratio;
+                    st.ratioWorstSeq = seq;
+                }
+            }
+            VectorPool<real>::give(std::move(probabilities));
+        }
+        if (tasks.check || tasks.rd) {
+            for (TasksState &st : states) {
+                st.penalties.clear();
+                st.rd = 0;
+            }
+            for (size_t agent : deviatingAgents(seq, g)) {
+                const size_t x = seq[agent];
+                for (size_t k = 0; k < lots.size(); ++k) states[k].agentCost = agent ? lotteryCost(x, profile, lots[k]) : states[k].baseCost;
+                const real baseRdCost = tasks.rd ? lotteryCost(x, profile, rdLottery<>) : 0;
+                for (const auto &seq2 : agent1_changes(seq, g.size - 1, agent)) {
+                    const real rdGain = tasks.rd ? baseRdCost - lotteryCost(x, seq2, g, rdLottery<>) : 0;
+                    for (size_t k = 0; k < lots.size(); ++k) {
+                        TasksState &st = states[k];
+                        const real penalty = lotteryCost(x, seq2, g, lots[k]) - st.agentCost;
+                        st.penalties.push_back(penalty);
+                        if (tasks.rd && penalty < -EPS) st.rd = max(st.rd, penalty / rdGain);
+                    }
+                }
+            }
+            for (TasksState &st : states) {
+                const real seqPenalty = minimum(st.penalties);
+                if (tasks.check && seqPenalty < st.minimalPenalty) {
+                    st.minimalPenalty = seqPenalty;
+                    st.checkWorstSeq = seq;
+                    st.associatedBaseCost = st.baseCost;
+                    st.associatedPenalties = st.penalties;
+                }
+                if (st.rd > st.rdVal) {
+                    st.rdVal = st.rd;
+                    st.rdWorstSeq = seq;
+                }
+            }
+        }
+        if (verbosity == Verbosity::all) {
+            printProfile(seq, g.anchored());
+            for (const TasksState &st : states) {
+                cout << '|';
+                if (tasks.check) cout << '\t' << r(minimum(st.penalties));
+                if (tasks.score) cout << '\t' << r(st.ratio);
+                if (tasks.rd) cout << '\t' << r(st.rd / (1 + st.rd));
+                cout << '\t';
+            }
+            cout << '\n';
+        }
     }
-};
 
-size_t get_opt_agent(conf c)
-{
-    auto [graph_ref, seq_ref] = c;
-    const l<size_t> &seq = seq_ref.get();
-    const Graph &graph = graph_ref.get();
-    size_t opt = 0;
-    real min_cost = numeric_limits<real>::infinity();
-    size_t right_agent = 0;
-    for (size_t curr_agent = 0; curr_agent < seq.size(); ++curr_agent)
-    {
-        while (seq[right_agent % seq.size()] + graph.size * (right_agent / seq.size()) - seq[curr_agent] < graph.size / 2)
-        {
-            ++right_agent;
+    struct Answers { bool strategyproof; real averageRatio, score, rd; };
+    auto answers = [&](const TasksState &st) {
+        Answers res{st.minimalPenalty >= -EPS, st.ratioSum / sequencesNum, st.worstRatio, st.rdVal / (1 + st.rdVal)};
+        if (tasks.avg) res.score = res.averageRatio;
+        if (tasks.distinctNum) res.score = distinctValues(st.ratioWorstSeq);
+        return res;
+    };
+    if (lots.size() == 1 && verbosity >= Verbosity::summary) {
+        const TasksState &st = states.front();
+        const Answers a = answers(st);
+        if (tasks.check) {
+            cout << "strategyproof: " << (a.strategyproof ? "yes" : "no") << '\n';
+            printCheckLine(st.checkWorstSeq, st.associatedBaseCost, st.associatedPenalties, g.anchored());
         }
-        if ((right_agent - curr_agent) * 2 - 1 == seq.size())
-        {
-            real curr_cost = getVertexCost(graph, seq, seq[curr_agent]);
-            if (curr_cost < min_cost)
-            {
-                min_cost = curr_cost;
-                opt = curr_agent;
-            }
+        if (tasks.score) {
+            cout << "----------------------------------------" << '\n';
+            cout << "number of processed sequences: " << sequencesNum << '\n';
+            cout << "approximation ratio: " << r(st.worstRatio) << '\n';
+            cout << "average approximation ratio: " << r(a.averageRatio) << '\n';
+            cout << "distinct points in worst sequence: " << distinctValues(st.ratioWorstSeq) << '\n';
+            printScoreLine(st.ratioWorstSeq, st.worstRatio, g.anchored());
+        }
+        if (tasks.rd) cout << "rd ratio: " << r(a.rd) << '\n';
+    }
+    else if (verbosity >= Verbosity::summary) {
+        cout << "number of processed sequences: " << sequencesNum << '\n';
+        cout << "mechanism";
+        if (tasks.check) cout << "\tstrategyproof";
+        if (tasks.score) cout << "\tapproximation ratio\taverage approximation ratio";
+        if (tasks.rd) cout << "\trd ratio";
+        cout << '\n';
+        for (size_t k = 0; k < lots.size(); ++k) {
+            const Answers a = answers(states[k]);
+            cout << names[k];
+            if (tasks.check) cout << '\t' << (a.strategyproof ? "yes" : "no");
+            if (tasks.score) cout << '\t' << r(states[k].worstRatio) << '\t' << r(a.averageRatio);
+            if (tasks.rd) cout << '\t' << r(a.rd);
+            cout << '\n';
+        }
+    }
+    else if (verbosity == Verbosity::answer) {
+        const char *sep = "";
+        for (const TasksState &st : states) {
+            const Answers a = answers(st);
+            if (tasks.check) cout << std::exchange(sep, "\t") << a.strategyproof;
+            if (tasks.score) cout << std::exchange(sep, "\t") << r(a.score);
+            if (tasks.rd) cout << std::exchange(sep, "\t") << r(a.rd);
         }
     }
-    return opt;
+    // structured answer is the one of score, then rd ratio, then check of the first lottery
+    const TasksState &first = states.front();
+    const Answers a = answers(first);
+    if (tasks.score) return {a.score, first.ratioWorstSeq, sequencesNum};
+    if (tasks.rd) return {a.rd, first.rdWorstSeq, sequencesNum};
+    return {real(a.strategyproof), first.checkWorstSeq, sequencesNum};
 }
 
-bool is_agent_middle(size_t curr_agent, conf c)
-{
-    auto [graph_ref, seq_ref] = c;
-    const l<size_t> &seq = seq_ref.get();
-    const Graph &graph = graph_ref.get();
-    size_t right_agent = curr_agent;
-    while (seq[right_agent % seq.size()] + graph.size * (right_agent / seq.size()) - seq[curr_agent] < graph.size / 2.0) ++right_agent;
-    return (right_agent - curr_agent) * 2 - 1 == seq.size();
-}
+// Joint deviation of a coalition of agents of seq: vertices of its members, vertices they
+// report instead and changes of their costs. Its value is the largest of the changes, so a
+// negative one lowers the cost of every member.
+struct CoalitionDeviation {
+    real value = numeric_limits<real>::infinity();
+    l<size_t> seq, members, targets;
+    l<real> changes;
+    bool betterThan(const CoalitionDeviation &d) const EXPR(value < d.value || (value == d.value && seq < d.seq))
+};
 
-bool is_0_opt(conf c)
-{
-    /* There may be more then one optimal point.
-    // We use the fact that in such case 0 would be selected by get_opt_agent
-    // as the first optimal point.
-    */
-    return get_opt_agent(c) == 0;
+void printCoalitionLine(const CoalitionDeviation &d, bool anchored) {
+    STAGE(output);
+    printProfile(d.seq, anchored);
+    cout << "|\t";
+    printR(d.members);
+    cout << "->\t";
+    printR(d.targets);
+    cout << "|\t";
+    printR(d.changes | transform([](real c)EXPR(r(c))));
+    cout << '\n';
 }
 
-real get_centrality(conf c, size_t span)
-{
-    auto [graph_ref, seq_ref] = c;
-    const Graph &graph = graph_ref.get();
-    const l<size_t> &seq = seq_ref.get();
-    size_t center = get_opt_agent(c);
-    real sum_of_central_distances = 0;
-    for (size_t i = center + seq.size() - span; i <= center + seq.size() + span; ++i)
-    {
-        sum_of_central_distances += graph.distance(seq[i % seq.size()], seq[center]);
+// Searches deviations of coalitions of up to maxCoalition agents including agent 0 (others
+// follow by rotation, on graphs that are not anchored the least member is any agent) for
+// the least value. Every member moves, as deviations keeping some
+// in place are those of smaller coalitions with an extra requirement, and members on the
+// same vertex are interchangeable, so they report vertices in nondecreasing order. Profiles
+// obtained by different deviations coincide often (members swapping reported vertices,
+// moving onto each other), so lotteries of deviated profiles are memoized per profile.
+// A member's cost is at least the distance to the nearest reported vertex, which bounds
+// the value of a deviation before its lottery is evaluated.
+class CoalitionSearch {
+    const lottery &lot;
+    const Graph &g;
+    size_t maxCoalition;
+    // distances between vertices, shared by searches of all threads
+    const l<real> &distances;
+    // offsets in memoized of lotteries of deviated profiles, keyed by removed and added
+    // vertices once those in both are cancelled, in an open addressing table kept allocated
+    // across searches: slots are occupied in the current search if they carry its stamp
+    l<uint64_t> memoKeys;
+    l<size_t> memoOffsets, memoStamps;
+    size_t memoSize = 0, stamp = 0;
+    l<real> memoized;
+    l<size_t> seq, memberIdx, targets, deviated, removed, added;
+    // costs of agents of seq under its lottery
+    l<real> costs;
+    real threshold;
+    CoalitionDeviation best;
+    real distance(size_t a, size_t b) const EXPR(distances[a * g.size + b])
+    uint64_t key() {
+        removed.clear();
+        for (size_t i : memberIdx) removed.push_back(seq[i]);
+        added.assign(targets.begin(), targets.end());
+        rn::sort(added);
+        // both are sorted, common vertices are dropped by merging them
+        size_t i = 0, j = 0, keptRemoved = 0, keptAdded = 0;
+        while (i < removed.size() || j < added.size()) {
+            if (j == added.size() || (i < removed.size() && removed[i] < added[j])) removed[keptRemoved++] = removed[i++];
+            else if (i == removed.size() || added[j] < removed[i]) added[keptAdded++] = added[j++];
+            else ++i, ++j;
+        }
+        uint64_t res = 0;
+        for (size_t k = 0; k < keptRemoved; ++k) res = res * (g.size + 1) + removed[k] + 1;
+        for (size_t k = 0; k < keptAdded; ++k) res = res * (g.size + 1) + added[k] + 1;
+        return res;
     }
-    real sum_of_other_distances = 0;
-    for (size_t i = center + span + 1; i < center + seq.size() - span; ++i)
-    {
-        sum_of_other_distances += graph.distance(seq[i % seq.size()], seq[center]);
+    size_t &memoSlot(uint64_t key, bool &inserted) {
+        const size_t mask = memoKeys.size() - 1;
+        uint64_t h = key * 0x9E3779B97F4A7C15ull;
+        for (size_t i = (h ^ h >> 32) & mask;; i = (i + 1) & mask) {
+            if (memoStamps[i] != stamp) {
+                memoStamps[i] = stamp;
+                memoKeys[i] = key;
+                ++memoSize;
+                inserted = true;
+                return memoOffsets[i];
+            }
+            if (memoKeys[i] == key) {
+                inserted = false;
+                return memoOffsets[i];
+            }
+        }
     }
-    real centrality = sum_of_other_distances / sum_of_central_distances;
-    return centrality;
-}
+    // offset in memoized of lottery with key, the next one to be memoized if inserted
+    size_t memo(uint64_t key, bool &inserted) {
+        // at most half of slots are occupied
+        if (2 * (memoSize + 1) > memoKeys.size()) {
+            l<uint64_t> keys = std::exchange(memoKeys, l<uint64_t>(max<size_t>(64, 2 * memoKeys.size())));
+            l<size_t> offsets = std::exchange(memoOffsets, l<size_t>(memoKeys.size()));
+            l<size_t> stamps = std::exchange(memoStamps, l<size_t>(memoKeys.size()));
+            memoSize = 0;
+            bool reinserted;
+            for (size_t i = 0; i < keys.size(); ++i) {
+                if (stamps[i] == stamp) memoSlot(keys[i], reinserted) = offsets[i];
+            }
+        }
+        size_t &offset = memoSlot(key, inserted);
+        if (inserted) offset = memoized.size();
+        return offset;
+    }
+    void evaluate() {
+        deviated.assign(seq.begin(), seq.end());
+        for (size_t k = memberIdx.size(); k-- > 0;) deviated.erase(deviated.begin() + memberIdx[k]);
+        for (size_t t : targets) deviated.insert(rn::upper_bound(deviated, t), t);
+        real bound = -numeric_limits<real>::infinity();
+        for (size_t i : memberIdx) {
+            real nearest = numeric_limits<real>::infinity();
+            for (size_t y : deviated) nearest = min(nearest, distance(seq[i], y));
+            bound = max(bound, nearest - costs[i]);
+        }
+        // the slack keeps ties evaluated, as rounding of the bound differs from that of values
+        if (bound > min(threshold, best.value) + EPS) {
+            ++pruned;
+            return;
+        }
+        ++evaluated;
+        bool inserted;
+        const size_t offset = memo(key(), inserted);
+        if (inserted) {
+            l<real> ps;
+            {
+                STAGE(lottery);
+                ps = lot(Profile(g, deviated));
+            }
+            memoized.insert(memoized.end(), ps.begin(), ps.end());
+            VectorPool<real>::give(std::move(ps));
+            ++lotteries;
+        }
+        STAGE(cost);
+        const real *ps = memoized.data() + offset;
+        real value = -numeric_limits<real>::infinity();
+        for (size_t i : memberIdx) {
+            real cost = 0;
+            for (size_t j = 0; j < deviated.size(); ++j) cost += distance(seq[i], deviated[j]) * ps[j];
+            // undefined costs are skipped, as check does
+            if (std::isnan(cost - costs[i])) return;
+            value = max(value, cost - costs[i]);
+        }
+        if (value < best.value) {
+            best.value = value;
+            best.seq.assign(seq.begin(), seq.end());
+            best.members.clear();
+            best.changes.clear();
+            for (size_t i : memberIdx) {
+                real cost = 0;
+                for (size_t j = 0; j < deviated.size(); ++j) cost += distance(seq[i], deviated[j]) * ps[j];
+                best.members.push_back(seq[i]);
+                best.changes.push_back(cost - costs[i]);
+            }
+            best.targets.assign(targets.begin(), targets.end());
+        }
+    }
+    // assigns reported vertices to members from the k-th one on
+    void deviate(size_t k) {
+        if (k == memberIdx.size()) return evaluate();
+        const size_t x = seq[memberIdx[k]];
+        const bool sameAsPrevious = k && seq[memberIdx[k - 1]] == x;
+        for (size_t v = sameAsPrevious ? targets[k - 1] : 0; v < g.size; ++v) {
+            if (v == x) continue;
+            targets[k] = v;
+            deviate(k + 1);
+        }
+    }
+    // chooses members following the first one from index from on, agents on the same vertex in order
+    void choose(size_t size, size_t from) {
+        if (memberIdx.size() == size) {
+            targets.resize(size);
+            return deviate(0);
+        }
+        for (size_t i = from; i < seq.size(); ++i) {
+            if (seq[i] == seq[i - 1] && memberIdx.back() != i - 1) continue;
+            memberIdx.push_back(i);
+            choose(size, i + 1);
+            memberIdx.pop_back();
+        }
+    }
+public:
+    size_t evaluated = 0, pruned = 0, lotteries = 0;
+    CoalitionSearch(const lottery &lot, const Graph &g, size_t maxCoalition, const l<real> &distances)
+    : lot(lot), g(g), maxCoalition(maxCoalition), distances(distances) {}
+    // least value of deviations of s, or of those of value not greater than threshold
+    // (others may be skipped)
+    const CoalitionDeviation &search(const l<size_t> &s, real threshold) {
+        seq.assign(s.begin(), s.end());
+        this->threshold = threshold;
+        best.value = numeric_limits<real>::infinity();
+        ++stamp;
+        memoSize = 0;
+        memoized.clear();
+        l<real> ps = lot(Profile(g, seq));
+        costs.assign(seq.size(), 0);
+        for (size_t i = 0; i < seq.size(); ++i) {
+            for (size_t j = 0; j < seq.size(); ++j) costs[i] += distance(seq[i], seq[j]) * ps[j];
+        }
+        VectorPool<real>::give(std::move(ps));
+        // smaller coalitions first, to prune larger ones by their values
+        for (size_t size = 1; size <= min(maxCoalition, seq.size()); ++size) {
+            for (size_t first : deviatingAgents(seq, g)) {
+                memberIdx.assign(1, first);
+                choose(size, first + 1);
+            }
+        }
+        return best;
+    }
+};
 
-std::function<bool(conf)> get_centrality_filter(real threshold, size_t span)
-{
-    return [=](conf c) EXPR(get_centrality(c, span) >= threshold);
+// Group strategyproofness for coalitions of up to maxCoalition agents: finds the deviation
+// of least value over all profiles (see CoalitionSearch), negative ones refute it. Profiles
+// are taken from gen in chunks by threads, each pruning by the least value it has found.
+Result coalitionCheck(const lottery &lot, seqs &gen, const Graph &g, size_t maxCoalition, size_t threads, Verbosity verbosity) {
+    STAGE_TASK(other);
+    if (pow(g.size + 1., 2. * maxCoalition) >= 0x1p64) throw std::invalid_argument("graph too large for coalitions of this size");
+    l<real> distances(g.size * g.size);
+    for (size_t a = 0; a < g.size; ++a) {
+        for (size_t b = 0; b < g.size; ++b) distances[a * g.size + b] = g.distance(a, b);
+    }
+    if (verbosity >= Verbosity::summary) cerr  << setprecision(2) << scientific << "estimated num of sequences: " << gen.approxSize() << '\n';
+    // printing every profile keeps them in order of generation
+    if (verbosity == Verbosity::all) threads = 1;
+    constexpr size_t chunkSize = 16;
+    std::mutex genMutex;
+    // generators must not be advanced once exhausted
+    bool exhausted = false;
+    size_t sequencesNum = 0;
+    l<CoalitionDeviation> found(max<size_t>(threads, 1));
+    std::atomic<size_t> evaluated = 0, pruned = 0, lotteries = 0;
+    auto worker = [&](CoalitionDeviation &res) {
+        CoalitionSearch search(lot, g, maxCoalition, distances);
+        l<l<size_t>> chunk(chunkSize);
+        for (;;) {
+            size_t taken = 0;
+            {
+                std::lock_guard lock(genMutex);
+                while (taken < chunkSize && !exhausted) {
+                    if (gen.advance()) chunk[taken++].assign(gen.get().begin(), gen.get().end());
+                    else exhausted = true;
+                }
+                sequencesNum += taken;
+            }
+            if (taken == 0) break;
+            for (size_t i = 0; i < taken; ++i) {
+                const CoalitionDeviation &d = search.search(chunk[i], verbosity == Verbosity::all ? numeric_limits<real>::infinity() : res.value);
+                if (verbosity == Verbosity::all && !d.seq.empty()) printCoalitionLine(d, g.anchored());
+                if (d.betterThan(res)) res = d;
+            }
+        }
+        evaluated += search.evaluated;
+        pruned += search.pruned;
+        lotteries += search.lotteries;
+    };
+    parallel(found.size(), [&](size_t t) { worker(found[t]); });
+    CoalitionDeviation worst;
+    for (const CoalitionDeviation &d : found) if (d.betterThan(worst)) worst = d;
+    Result res{real(worst.value >= -EPS), worst.seq, sequencesNum, worst.value, 0, 0, worst.changes};
+    if (verbosity >= Verbosity::summary) {
+        cout << "group strategyproof for coalitions of up to " << maxCoalition << " agents: " << (res.answer ? "yes" : "no") << '\n';
+        if (!worst.seq.empty()) printCoalitionLine(worst, g.anchored());
+        cerr << "coalition deviations: " << evaluated << " evaluated, " << pruned << " pruned, "
+            << lotteries << " lotteries computed\n";
+        STAGE_PRINT(cerr);
+    } else if (verbosity == Verbosity::answer) cout << bool(res.answer);
+    return res;
 }
 
-bool is_sparse(real threshold, conf c)
-{
-    auto [graph_ref, seq_ref] = c;
-    const Graph &graph = graph_ref.get();
-    const l<size_t> &seq = seq_ref.get();
-    auto dis_opp = oppositeDistances(graph, seq);
-    real min_distance = minimum(dis_opp);
-    return min_distance >= threshold;
-}
+// Certified mode: reals screen every sequence, and only values within band of a
+// decision boundary are recomputed exactly. Rounding errors of real evaluation are
+// assumed to be below band (they are of order 1e-15 for graphs we analyse).
+// Exact distances assume the graph is a uniform Circle.
 
-std::function<bool(conf)> get_sparse_filter(real threshold)
-{
-    return bind_front(is_sparse, threshold);
+Rational exactDistance(const Graph &g, size_t a, size_t b) {
+    size_t diff = a < b ? b - a : a - b;
+    return Rational(min(diff, g.size - diff), g.size);
 }
 
-std::function<bool(conf)> negate(std::function<bool(conf)> f)
-{
-    return [=](conf c) EXPR(!f(c));
+Rational exactVertexCost(const Graph &g, const l<size_t> &seq, size_t vertex) {
+    Rational res = 0;
+    for (size_t x : seq) res += exactDistance(g, vertex, x);
+    return res;
 }
 
-std::function<bool(conf)> skip(bool cond, std::function<bool(conf)> f)
-{
-    return cond ? [](conf) EXPR(true) : f;
+Rational exactLotteryCost(size_t a, const l<size_t> &bs, const Graph &g, const exactLottery &lot) {
+    l<Rational> ps = lot(Profile(g, bs));
+    Rational res = 0;
+    for (size_t i = 0; i < bs.size(); ++i) res += exactDistance(g, a, bs[i]) * ps[i];
+    return res;
 }
 
-cppcoro::generator<const l<size_t>&> agent1_changes(l<size_t> seq, size_t end)
-{
-    auto elIter = seq.begin();
-    while(++*elIter <= end) {
-        while(next(elIter) != seq.end() && *elIter > *next(elIter)) {
-            std::iter_swap(elIter, next(elIter));
-            ++elIter;
-        }
-        co_yield seq;
+Rational exactApproximationRatio(const exactLottery &lot, const Graph &g, const l<size_t> &seq) {
+    l<Rational> ps = lot(Profile(g, seq));
+    Rational realCost = 0;
+    Rational optimalCost = exactVertexCost(g, seq, seq[0]);
+    for (size_t i = 0; i < seq.size(); ++i) {
+        Rational c = exactVertexCost(g, seq, seq[i]);
+        realCost += ps[i] * c;
+        optimalCost = min(optimalCost, c);
     }
+    // on a cycle optimal cost is 0 only if all agents share location
+    return optimalCost == 0 ? Rational(1) : realCost / optimalCost;
 }
 
-enum class Verbosity { none, answer, summary, all };
-
-template<rn::input_range R>
-real cost(size_t a, R && bs, const l<real> &ps, const Graph &g) {
-    return inner_product(bs.begin(), bs.end(), ps.begin(), 0., plus<>(),
-        [&a, &g](size_t b, real p) EXPR(g.distance(a, b) * p));
-}
-
-real lotteryCost(size_t a, const l<size_t> &bs, const Graph &g, const lottery &lot) {
-    return cost(a, bs, lot(bs), g);
-}
-
-bool check(lottery lot, seqs &gen, const Graph &g, Verbosity verbosity) {
-    auto printLine = [](const auto &seq, real base_cost, const auto &penalties){
-        printR(seq | drop(1));
-        cout << "|\t" << r(base_cost) << '\t';
-        printR(penalties | transform([](real p)EXPR(r(p))));
-        cout << '\n';
-    };
-    real minimalPenalty = numeric_limits<real>::infinity();
+Result certifiedCheck(const lottery &lot, const exactLottery &exact, seqs &gen, const Graph &g, Verbosity verbosity, real band) {
+    size_t sequencesNum = 0;
+    size_t recheckedNum = 0;
+    // most negative penalty that was certain without exact recomputation
+    real minimalPenalty = -band;
     l<size_t> worstSeq;
-    real associatedBaseCost = 0;
-    l<real> associatedPenalties;
+    // most negative exactly recomputed penalty
+    Rational minimalExactPenalty = 0;
+    l<size_t> worstExactSeq;
 
     if (verbosity >= Verbosity::summary) cerr  << setprecision(2) << scientific << "estimated num of sequences: " << gen.approxSize() << '\n';
     for (const l<size_t> &seq : gen.toGen()) {
-        real base_cost = lotteryCost(0, seq, g, lot);
-        vector<real> penalties;
-        penalties.reserve(g.size - 1);
+        ++sequencesNum;
+        real baseCost = lotteryCost(0, *CurrentProfile(gen, g), lot);
+        bool rechecked = false;
+        Rational exactBaseCost, exactPenalty;
         for (const auto &seq2 : agent1_changes(seq, g.size - 1)) {
-            penalties.push_back(lotteryCost(0, seq2, g, lot) - base_cost);
+            real penalty = lotteryCost(0, seq2, g, lot) - baseCost;
+            if (penalty < minimalPenalty) {
+                minimalPenalty = penalty;
+                worstSeq = seq;
+            }
+            else if (penalty >= -band && penalty <= band) {
+                if (!rechecked) {
+                    rechecked = true;
+                    exactBaseCost = exactLotteryCost(0, seq, g, exact);
+                    exactPenalty = exactLotteryCost(0, seq2, g, exact) - exactBaseCost;
+                }
+                else exactPenalty = min(exactPenalty, exactLotteryCost(0, seq2, g, exact) - exactBaseCost);
+            }
         }
-        real tmp = minimum(penalties);
-        if(tmp < minimalPenalty) {
-            minimalPenalty = tmp;
-            worstSeq = seq;
-            associatedBaseCost = base_cost;
-            associatedPenalties = penalties;
+        if (!rechecked) continue;
+        ++recheckedNum;
+        if (exactPenalty < minimalExactPenalty) {
+            minimalExactPenalty = exactPenalty;
+            worstExactSeq = seq;
+        }
+        if (verbosity == Verbosity::all) {
+            printR(seq | drop(1));
+            cout << "|\t" << exactPenalty << '\n';
         }
-        if (verbosity == Verbosity::all) printLine(seq, base_cost, penalties);
     }
-    bool strategyproof = minimalPenalty >= -EPS;
-    if (verbosity == Verbosity::summary) {
+    bool strategyproof = worstSeq.empty() && worstExactSeq.empty();
+    if (verbosity >= Verbosity::summary) {
+        cout << "----------------------------------------" << '\n';
+        cout << "number of processed sequences: " << sequencesNum << '\n';
+        cout << "exactly rechecked sequences: " << recheckedNum << '\n';
         cout << "strategyproof: " << (strategyproof ? "yes" : "no") << '\n';
-        printLine(worstSeq, associatedBaseCost, associatedPenalties);
+        if (!worstSeq.empty()) {
+            printR(worstSeq | drop(1));
+            cout << "|\t" << r(minimalPenalty) << '\n';
+        }
+        else if (!worstExactSeq.empty()) {
+            printR(worstExactSeq | drop(1));
+            cout << "|\t" << minimalExactPenalty << '\n';
+        }
     } else if (verbosity == Verbosity::answer) cout << strategyproof;
-    return strategyproof;
+    return {real(strategyproof), worstSeq.empty() ? worstExactSeq : worstSeq, sequencesNum};
 }
 
-real rdRatio(lottery lot, seqs &gen, const Graph &g, Verbosity verbosity) {
-    real rdVal = 0;
+Result certifiedScore(const lottery &lot, const exactLottery &exact, seqs &gen, const Graph &g, Verbosity verbosity, real band) {
+    size_t sequencesNum = 0;
+    real screenedRatio = 0;
+    // sequences that may turn out to be the worst after exact recomputation
+    l<std::pair<l<size_t>, real>> candidates;
 
+    if (verbosity >= Verbosity::summary) cerr  << setprecision(2) << scientific << "estimated num of sequences: " << gen.approxSize() << '\n';
     for (const l<size_t> &seq : gen.toGen()) {
-        real baseCost = lotteryCost(0, seq, g, lot);
-        real baseRdCost = lotteryCost(0, seq, g, rdLottery);
-        for (const auto &seq : agent1_changes(seq, g.size - 1)) {
-            real penalty = lotteryCost(0, seq, g, lot) - baseCost;
-            if (penalty < -EPS) rdVal = max(rdVal, penalty / (baseRdCost - lotteryCost(0, seq, g, rdLottery)));
+        ++sequencesNum;
+        const real approx = approximationRatio(lot, *CurrentProfile(gen, g));
+        if (approx < screenedRatio - band) continue;
+        if (approx > screenedRatio) {
+            screenedRatio = approx;
+            std::erase_if(candidates, [&](const auto &c) EXPR(c.second < screenedRatio - band));
+        }
+        candidates.emplace_back(seq, approx);
+    }
+    Rational result = 0;
+    l<size_t> worstSeq;
+    for (const auto &[seq, approx] : candidates) {
+        Rational exactApprox = exactApproximationRatio(exact, g, seq);
+        if (exactApprox > result) {
+            result = exactApprox;
+            worstSeq = seq;
+        }
+        if (verbosity == Verbosity::all) {
+            printR(seq | drop(1));
+            cout << "|\t" << exactApprox << '\n';
         }
     }
-    real res = rdVal / (1 + rdVal);
     if (verbosity >= Verbosity::summary) {
-        cout << "rd ratio: " << r(res) << '\n';
-    } else if (verbosity == Verbosity::answer) cout << r(res);
-    return res;
+        cout << "----------------------------------------" << '\n';
+        cout << "number of processed sequences: " << sequencesNum << '\n';
+        cout << "exactly rechecked sequences: " << candidates.size() << '\n';
+        cout << "approximation ratio: " << r(real(result)) << " = " << result << '\n';
+        printR(worstSeq | drop(1));
+        cout << "|\t" << result << '\n';
+    }
+    else if (verbosity == Verbosity::answer)
+        cout << r(real(result));
+    return {real(result), worstSeq, sequencesNum};
 }
 
-real score(const Quantity &scorer, seqs &gen, const Graph &g, Verbosity verbosity, bool avg = false, bool distinctNum = false)
+// Calls f for every sequence starting with 0 which is nondecreasing and differs
+// from center by at most radius on each position.
+void forNeighbours(const l<size_t> &center, size_t size, size_t radius, const function<void(const l<size_t>&)> &f) {
+    l<size_t> seq{0};
+    auto extend = [&](auto &self) -> void {
+        if (seq.size() == center.size()) return f(seq);
+        size_t c = center[seq.size()];
+        size_t low = max(seq.back(), c < radius ? 0 : c - radius);
+        size_t high = min(size - 1, c + radius);
+        for (size_t x = low; x <= high; ++x) {
+            seq.push_back(x);
+            self(self);
+            seq.pop_back();
+        }
+    };
+    extend(extend);
+}
+
+// Coarse-to-fine search of the worst approximation ratio. The coarse level is
+// processed exhaustively; each next level doubles the graph size and evaluates
+// only neighbourhoods of scaled up topK worst sequences of the previous level.
+// Filters of gen apply to the coarse level only.
+Result multiResolutionScore(const function<lottery(size_t)> &lotteryForSize, seqs &gen, const Graph &g,
+    size_t levels, size_t topK, Verbosity verbosity)
 {
-    auto printLine = [](const auto &seq, real approx) {
-        printR(seq | drop(1));
-        cout << "|\t" << r(approx) << '\n';
+    using scored = std::pair<real, l<size_t>>;
+    // min-heap of topK worst sequences of current level
+    l<scored> best;
+    auto keep = [&best, topK](real value, const l<size_t> &seq) {
+        if (best.size() < topK) best.emplace_back(value, seq);
+        else if (value > best.front().first) {
+            rn::pop_heap(best, std::greater<>());
+            best.back() = {value, seq};
+        }
+        else return;
+        rn::push_heap(best, std::greater<>());
+    };
+    // sequences gen would yield on a circle of given size; spaces it cannot count are
+    // scaled from its estimate like all sequences
+    auto spaceSize = [&](size_t size, size_t agentsNum) {
+        if (std::optional<SeqSpace> space = gen.space()) {
+            space->values = size;
+            return space->count();
+        }
+        return gen.approxSize() * numOfIncreasingSeqs(agentsNum - 1, size) / numOfIncreasingSeqs(agentsNum - 1, g.size);
+    };
+    auto printLevel = [&](size_t size, size_t evaluated) {
+        const scored &worst = *rn::max_element(best);
+        real coverage = evaluated / spaceSize(size, worst.second.size());
+        cout << "V=" << size << "\tapproximation ratio: " << r(worst.first)
+            << "\tevaluated: " << evaluated << " (" << r(100 * coverage, 2) << "% of sequences)\n";
+        if (verbosity == Verbosity::all) {
+            printR(worst.second | drop(1));
+            cout << "|\t" << r(worst.first) << '\n';
+        }
     };
+
     size_t sequencesNum = 0;
-    real globalApproximationRatio = 0;
-    real approximationRatioSum = 0;
-    l<size_t> worstSeq;
+    size_t size = g.size;
+    lottery lot = lotteryForSize(size);
     if (verbosity >= Verbosity::summary) cerr  << setprecision(2) << scientific << "estimated num of sequences: " << gen.approxSize() << '\n';
     for (const l<size_t> &seq : gen.toGen()) {
         ++sequencesNum;
-        const real approx = scorer(seq, g);
-        if (approx > globalApproximationRatio)
-        {
-            globalApproximationRatio = approx;
-            worstSeq = seq;
-        }
-        approximationRatioSum += approx;
-        if (verbosity == Verbosity::all) printLine(seq, approx);
+        keep(approximationRatio(lot, *CurrentProfile(gen, g)), seq);
     }
-    real averageApproximationRatio = approximationRatioSum / sequencesNum;
-    real result = avg ? averageApproximationRatio : globalApproximationRatio;
-    if (distinctNum) {
-        // assign number of disctinct values in the worst sequence to result
-        result = 1;
-        for (size_t i = 1; i < worstSeq.size(); ++i) {
-            if (worstSeq[i] != worstSeq[i - 1]) ++result;
+    if (best.empty()) return {};
+    if (verbosity >= Verbosity::summary) printLevel(size, sequencesNum);
+
+    for (size_t level = 1; level < levels; ++level) {
+        l<scored> candidates = std::exchange(best, {});
+        size *= 2;
+        lot = lotteryForSize(size);
+        Circle graph(size);
+        std::set<l<size_t>> visited;
+        for (const auto &[_, coarse] : candidates) {
+            l<size_t> center = toVec(coarse | transform([](size_t x) EXPR(2 * x)));
+            // every vertex of finer graph rounds to one of its neighbours scaled up
+            forNeighbours(center, size, 1, [&](const l<size_t> &seq) {
+                if (visited.insert(seq).second) keep(approximationRatio(lot, graph, seq), seq);
+            });
         }
+        sequencesNum += visited.size();
+        if (verbosity >= Verbosity::summary) printLevel(size, visited.size());
     }
+
+    const auto &[result, worstSeq] = *rn::max_element(best);
     if (verbosity >= Verbosity::summary) {
         cout << "----------------------------------------" << '\n';
         cout << "number of processed sequences: " << sequencesNum << '\n';
         cout << "approximation ratio: " << r(result) << '\n';
-        printLine(worstSeq, globalApproximationRatio);
+        printR(worstSeq | drop(1));
+        cout << "|\t" << r(result) << '\n';
     }
     else if (verbosity == Verbosity::answer)
         cout << r(result);
-    return result;
+    return {result, worstSeq, sequencesNum};
+}
+
+// Statistics of values of sampled sequences (greater value is worse).
+struct SampleStats {
+    size_t num = 0;
+    real sum = 0;
+    real sumSq = 0;
+    // number of values exceeding EPS
+    size_t positive = 0;
+    real worst = -numeric_limits<real>::infinity();
+    l<size_t> worstSeq{};
+    void add(real value, const l<size_t> &seq) {
+        ++num;
+        sum += value;
+        sumSq += value * value;
+        positive += value > EPS;
+        if (value > worst) {
+            worst = value;
+            worstSeq = seq;
+        }
+    }
+    void merge(const SampleStats &o) {
+        num += o.num;
+        sum += o.sum;
+        sumSq += o.sumSq;
+        positive += o.positive;
+        if (o.worst > worst) {
+            worst = o.worst;
+            worstSeq = o.worstSeq;
+        }
+    }
+    real mean() const EXPR(sum / num)
+    // half width of 95% confidence interval of the mean
+    real meanError() const EXPR(1.96 * std::sqrt(max(0., sumSq / num - mean() * mean()) / num))
+    real fraction() const EXPR(real(positive) / num)
+    real fractionError() const EXPR(1.96 * std::sqrt(fraction() * (1 - fraction()) / num))
+};
+
+constexpr size_t sampleBlockSize = 4096;
+
+// Evaluates samples in blocks, each drawn from its own generator seeded by block index,
+// so results do not depend on the number of threads.
+SampleStats sampleBlocks(size_t samples, size_t threads, const function<unique_ptr<seqs>(size_t, size_t)> &makeGen,
+    const function<real(const l<size_t> &)> &value)
+{
+    size_t blocks = (samples + sampleBlockSize - 1) / sampleBlockSize;
+    l<SampleStats> stats(blocks);
+    std::atomic<size_t> nextBlock = 0;
+    auto worker = [&]() {
+        for (size_t b; (b = nextBlock++) < blocks;) {
+            unique_ptr<seqs> gen = makeGen(b, min(sampleBlockSize, samples - b * sampleBlockSize));
+            for (const l<size_t> &seq : gen->toGen()) stats[b].add(value(seq), seq);
+        }
+    };
+    parallel(min(threads, blocks), [&](size_t) { worker(); });
+    SampleStats res;
+    for (const SampleStats &s : stats) res.merge(s);
+    return res;
+}
+
+void printSampleSummary(const SampleStats &stats, const char *worstName, real worst) {
+    cout << "----------------------------------------" << '\n';
+    cout << "number of sampled sequences: " << stats.num << '\n';
+    cout << worstName << " (worst found): " << r(worst) << '\n';
+    printScoreLine(stats.worstSeq, worst);
+}
+
+Result sampleCheck(const lottery &lot, const Graph &g, size_t samples, size_t threads,
+    const function<unique_ptr<seqs>(size_t, size_t)> &makeGen, Verbosity verbosity)
+{
+    SampleStats stats = sampleBlocks(samples, threads, makeGen, [&](const l<size_t> &seq) EXPR(-worstPenalty(lot, g, seq)));
+    bool violationFound = stats.positive > 0;
+    if (verbosity >= Verbosity::summary) {
+        cout << "strategyproof: " << (violationFound ? "no" : "not refuted") << '\n';
+        cout << "fraction of violating sequences: " << r(stats.fraction()) << " +- " << r(stats.fractionError()) << '\n';
+        printSampleSummary(stats, "penalty", -stats.worst);
+    } else if (verbosity == Verbosity::answer) cout << !violationFound;
+    return {real(!violationFound), stats.worstSeq, stats.num};
+}
+
+Result sampleScore(const Quantity &scorer, const Graph &g, size_t samples, size_t threads,
+    const function<unique_ptr<seqs>(size_t, size_t)> &makeGen, Verbosity verbosity, bool avg = false)
+{
+    SampleStats stats = sampleBlocks(samples, threads, makeGen, [&](const l<size_t> &seq) EXPR(scorer(seq, g)));
+    real result = avg ? stats.mean() : stats.worst;
+    if (verbosity >= Verbosity::summary) {
+        cout << "average approximation ratio: " << r(stats.mean()) << " +- " << r(stats.meanError()) << '\n';
+        printSampleSummary(stats, "approximation ratio", stats.worst);
+    } else if (verbosity == Verbosity::answer) cout << r(result);
+    return {result, stats.worstSeq, stats.num};
+}
+
+Result sampleRdRatio(const lottery &lot, const Graph &g, size_t samples, size_t threads,
+    const function<unique_ptr<seqs>(size_t, size_t)> &makeGen, Verbosity verbosity)
+{
+    SampleStats stats = sampleBlocks(samples, threads, makeGen, [&](const l<size_t> &seq) {
+        real rdVal = 0;
+        real baseCost = lotteryCost(0, seq, g, lot);
+        real baseRdCost = lotteryCost(0, seq, g, rdLottery<>);
+        for (const auto &seq2 : agent1_changes(seq, g.size - 1)) {
+            real penalty = lotteryCost(0, seq2, g, lot) - baseCost;
+            if (penalty < -EPS) rdVal = max(rdVal, penalty / (baseRdCost - lotteryCost(0, seq2, g, rdLottery<>)));
+        }
+        return rdVal;
+    });
+    real res = stats.worst / (1 + stats.worst);
+    if (verbosity >= Verbosity::summary) printSampleSummary(stats, "rd ratio", res);
+    else if (verbosity == Verbosity::answer) cout << r(res);
+    return {res, stats.worstSeq, stats.num};
+}
+
+// Rotates sorted seq on circle of given size by -shift and then so that its least vertex is 0.
+l<size_t> canonicalSeq(l<size_t> seq, size_t size, size_t shift = 0) {
+    for (size_t &x : seq) x = (x + size - shift) % size;
+    rn::sort(seq);
+    size_t first = seq.front();
+    for (size_t &x : seq) x -= first;
+    return seq;
+}
+
+// Starting sequence of local search: uniformly random vertices (kind 0),
+// evenly spread agents (kind 1) or two clusters of random sizes (kind 2).
+template<typename R>
+l<size_t> localSeed(size_t kind, size_t agentsNum, size_t size, R &rng) {
+    auto pick = [&rng](size_t n) EXPR(std::uniform_int_distribution<size_t>(0, n - 1)(rng));
+    size_t other = pick(size), split = 1 + pick(agentsNum);
+    l<size_t> seq(agentsNum);
+    for (size_t i = 0; i < agentsNum; ++i) {
+        if (kind == 0) seq[i] = pick(size);
+        else if (kind == 1) seq[i] = i * size / agentsNum;
+        else seq[i] = i < split ? 0 : other;
+    }
+    return canonicalSeq(seq, size);
+}
+
+// Random neighbour of seq: shift of one agent, merge of an agent into cluster of another one,
+// split of a cluster by moving one of its agents anywhere or rotation moving another agent to 0.
+template<typename R>
+l<size_t> localMove(l<size_t> seq, size_t size, R &rng) {
+    auto pick = [&rng](size_t n) EXPR(std::uniform_int_distribution<size_t>(0, n - 1)(rng));
+    size_t i = pick(seq.size());
+    switch (pick(4)) {
+    case 0: {
+        // shift by at most an eighth of the circle
+        size_t delta = 1 + pick(max<size_t>(1, size / 8));
+        seq[i] = (pick(2) ? seq[i] + delta : seq[i] + size - delta) % size;
+        break;
+    }
+    case 1:
+        seq[i] = seq[pick(seq.size())];
+        break;
+    case 2: {
+        l<size_t> clustered;
+        for (size_t j = 0; j < seq.size(); ++j) {
+            if ((j > 0 && seq[j] == seq[j - 1]) || (j + 1 < seq.size() && seq[j] == seq[j + 1])) clustered.push_back(j);
+        }
+        if (!clustered.empty()) i = clustered[pick(clustered.size())];
+        seq[i] = pick(size);
+        break;
+    }
+    default:
+        return canonicalSeq(seq, size, seq[i]);
+    }
+    return canonicalSeq(seq, size);
+}
+
+// Simulated annealing maximising value over sequences of agentsNum agents on circle of given size.
+// Every restart draws its seed sequence and moves from its own generator seeded by restart index,
+// so results do not depend on the number of threads. Report is called on every improvement
+// of the best value found by all threads so far.
+SampleStats localSearch(size_t agentsNum, size_t size, size_t restarts, size_t steps, size_t threads, size_t seed,
+    const function<real(const l<size_t> &)> &value, const function<void(const l<size_t> &, real)> &report)
+{
+    l<SampleStats> stats(restarts);
+    std::atomic<size_t> nextRestart = 0;
+    std::mutex reportMutex;
+    real reported = -numeric_limits<real>::infinity();
+    auto worker = [&]() {
+        for (size_t restart; (restart = nextRestart++) < restarts;) {
+            std::seed_seq seedSeq{seed, restart};
+            std::mt19937_64 rng(seedSeq);
+            std::uniform_real_distribution<real> uniform;
+            SampleStats &s = stats[restart];
+            auto visit = [&](const l<size_t> &seq, real v) {
+                bool improved = v > s.worst;
+                s.add(v, seq);
+                if (!improved) return;
+                std::scoped_lock lock(reportMutex);
+                if (v > reported) report(seq, reported = v);
+            };
+            l<size_t> current = localSeed(restart % 3, agentsNum, size, rng);
+            real currentValue = value(current);
+            visit(current, currentValue);
+            // temperature relative to magnitude of the starting value, cooling linearly to 0
+            real initialTemperature = 0.05 * max(std::abs(currentValue), EPS);
+            for (size_t step = 0; step < steps; ++step) {
+                l<size_t> candidate = localMove(current, size, rng);
+                real v = value(candidate);
+                visit(candidate, v);
+                real temperature = initialTemperature * (steps - step) / steps;
+                if (v >= currentValue || uniform(rng) < std::exp((v - currentValue) / temperature)) {
+                    current = std::move(candidate);
+                    currentValue = v;
+                }
+            }
+        }
+    };
+    parallel(min(threads, restarts), [&](size_t) { worker(); });
+    SampleStats res;
+    for (const SampleStats &s : stats) res.merge(s);
+    return res;
+}
+
+Result localScore(const Quantity &scorer, const Graph &g, size_t agentsNum, size_t restarts, size_t steps,
+    size_t threads, size_t seed, Verbosity verbosity)
+{
+    SampleStats stats = localSearch(agentsNum, g.size, restarts, steps, threads, seed,
+        [&](const l<size_t> &seq) EXPR(scorer(seq, g)),
+        [&](const l<size_t> &seq, real v) { if (verbosity == Verbosity::all) printScoreLine(seq, v); });
+    if (verbosity >= Verbosity::summary) {
+        cout << "----------------------------------------" << '\n';
+        cout << "number of processed sequences: " << stats.num << '\n';
+        cout << "approximation ratio: " << r(stats.worst) << '\n';
+        printScoreLine(stats.worstSeq, stats.worst);
+    }
+    else if (verbosity == Verbosity::answer)
+        cout << r(stats.worst);
+    return {stats.worst, stats.worstSeq, stats.num};
 }
 
-real uniformRank(real) EXPR(1)
+Result localCheck(const lottery &lot, const Graph &g, size_t agentsNum, size_t restarts, size_t steps,
+    size_t threads, size_t seed, Verbosity verbosity)
+{
+    auto printLine = [&](const l<size_t> &seq) {
+        real baseCost = lotteryCost(0, seq, g, lot);
+        l<real> penalties;
+        for (const auto &seq2 : agent1_changes(seq, g.size - 1)) penalties.push_back(lotteryCost(0, seq2, g, lot) - baseCost);
+        printCheckLine(seq, baseCost, penalties);
+    };
+    SampleStats stats = localSearch(agentsNum, g.size, restarts, steps, threads, seed,
+        [&](const l<size_t> &seq) EXPR(-worstPenalty(lot, g, seq)),
+        [&](const l<size_t> &seq, real) { if (verbosity == Verbosity::all) printLine(seq); });
+    bool violationFound = stats.worst > EPS;
+    if (verbosity >= Verbosity::summary) {
+        cout << "strategyproof: " << (violationFound ? "no" : "not refuted") << '\n';
+        printLine(stats.worstSeq);
+    } else if (verbosity == Verbosity::answer) cout << !violationFound;
+    return {real(!violationFound), stats.worstSeq, stats.num};
+}
@@ -0,0 +1,135 @@
+#include "libcycle.h"
+#include "lib.h"
+
+struct cm_mechanism {
+    Circle graph;
+    size_t agentsNum;
+    lottery lot;
+};
+
+namespace {
+
+thread_local string lastError;
+
+// Runs f, turning exceptions into the error code and message of the C interface.
+template<typename F>
+int guarded(F f) {
+    try {
+        f();
+        return 0;
+    } catch (const std::exception &e) {
+        lastError = e.what();
+        return -1;
+    }
+}
+
+// Vector taken from VectorPool for the lifetime of the guard, given back also on exceptions.
+template<typename T>
+struct PooledVector {
+    l<T> v = VectorPool<T>::take();
+    PooledVector() = default;
+    PooledVector(const PooledVector &) = delete;
+    ~PooledVector() { VectorPool<T>::give(std::move(v)); }
+};
+
+// Calls f with index and vertices of every profile of the batch, checked and copied into
+// storage taken from VectorPool.
+template<typename F>
+void forEachProfile(const cm_mechanism *mechanism, const uint32_t *profiles, size_t count, F f) {
+    if (!mechanism) throw std::invalid_argument("no mechanism");
+    if (count && !profiles) throw std::invalid_argument("no profiles");
+    const cm_mechanism &m = *mechanism;
+    PooledVector<size_t> pooled;
+    l<size_t> &seq = pooled.v;
+    seq.resize(m.agentsNum);
+    for (size_t i = 0; i < count; ++i) {
+        const uint32_t *profile = profiles + i * m.agentsNum;
+        for (size_t j = 0; j < m.agentsNum; ++j) {
+            if (profile[j] >= m.graph.size || (j && profile[j] < profile[j - 1]))
+                throw std::invalid_argument("profile " + std::to_string(i) + " is not a nondecreasing sequence of vertices");
+            seq[j] = profile[j];
+        }
+        f(i, seq);
+    }
+}
+
+}
+
+extern "C" {
+
+cm_mechanism *cm_mechanism_create(size_t graph_size, size_t agents_num, const char *spec) {
+    try {
+        if (!graph_size || !agents_num) throw std::invalid_argument("graph and profiles have to be nonempty");
+        unique_ptr<cm_mechanism> m(new cm_mechanism{Circle(graph_size), agents_num, {}});
+        std::istringstream in(spec ? spec : "");
+        l<string> tokens{std::istream_iterator<string>(in), std::istream_iterator<string>()};
+        l<const char *> args;
+        for (const string &token : tokens) args.push_back(token.c_str());
+        args.push_back(nullptr);
+        const char **argv = args.data();
+        const l<real> positions;
+        m->lot = parseMechanism<real>(argv, graph_size,
+            [&] EXPR(parseMethod<real>(argv, {graph_size, agents_num, positions, m->graph})));
+        if (*argv) throw std::invalid_argument(string{"unconsumed arguments left: "} + *argv);
+        return m.release();
+    } catch (const std::exception &e) {
+        lastError = e.what();
+        return nullptr;
+    }
+}
+
+void cm_mechanism_free(cm_mechanism *mechanism) {
+    delete mechanism;
+}
+
+int cm_lottery(const cm_mechanism *m, const uint32_t *profiles, size_t count, double *probabilities) {
+    return guarded([&] {
+        forEachProfile(m, profiles, count, [&](size_t i, const l<size_t> &seq) {
+            l<real> ps = m->lot(Profile(m->graph, seq));
+            if (ps.size() != m->agentsNum) throw std::logic_error("lottery does not match num of agents");
+            rn::copy(ps, probabilities + i * m->agentsNum);
+            VectorPool<real>::give(std::move(ps));
+        });
+    });
+}
+
+int cm_vertex_costs(const cm_mechanism *m, const uint32_t *profiles, size_t count, double *costs) {
+    return guarded([&] {
+        forEachProfile(m, profiles, count, [&](size_t i, const l<size_t> &seq) {
+            for (size_t v = 0; v < m->graph.size; ++v) costs[i * m->graph.size + v] = getVertexCost(m->graph, seq, v);
+        });
+    });
+}
+
+int cm_approximation_ratios(const cm_mechanism *m, const uint32_t *profiles, size_t count, double *ratios) {
+    return guarded([&] {
+        forEachProfile(m, profiles, count, [&](size_t i, const l<size_t> &seq) {
+            ratios[i] = approximationRatio(m->lot, Profile(m->graph, seq));
+        });
+    });
+}
+
+int cm_sp_penalties(const cm_mechanism *m, const uint32_t *profiles, size_t count, double *penalties) {
+    return guarded([&] {
+        PooledVector<size_t> rotated;
+        forEachProfile(m, profiles, count, [&](size_t i, const l<size_t> &seq) {
+            // rotating the circle brings each agent in turn to vertex 0, whose deviations
+            // worstPenalty checks; agents on one vertex are interchangeable
+            real res = numeric_limits<real>::infinity();
+            for (size_t first = 0; first < seq.size(); ++first) {
+                if (first && seq[first] == seq[first - 1]) continue;
+                rotated.v.clear();
+                for (size_t j = first; j < seq.size(); ++j) rotated.v.push_back(seq[j] - seq[first]);
+                for (size_t j = 0; j < first; ++j) rotated.v.push_back(seq[j] + m->graph.size - seq[first]);
+                res = min(res, worstPenalty(m->lot, m->graph, rotated.v));
+            }
+            penalties[i] = res;
+        });
+    });
+}
+
+const char *cm_last_error(void) {
+    return lastError.c_str();
+}
+
+}
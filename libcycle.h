@@ -0,0 +1,58 @@
+/* C interface of the solver library (make libcycle.so), evaluating mechanisms on batches
+ * of profiles without spawning the solver and parsing its output.
+ *
+ * A profile is a nondecreasing sequence of agents_num vertices of the circle of size
+ * graph_size given to cm_mechanism_create. A batch of count profiles is passed as a flat
+ * array of count * agents_num vertices, results are written to caller-owned buffers.
+ * Once storage reused between calls is warm, evaluation does not allocate (except for
+ * custom and randomized lotteries). Functions may be called concurrently on the same
+ * mechanism.
+ *
+ * Functions returning int return 0 on success and -1 on error (also for a NULL mechanism),
+ * whose description is then available from cm_last_error. Buffers are left partially written on error. */
+#ifndef LIBCYCLE_H
+#define LIBCYCLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__)
+#define CM_API __attribute__((visibility("default")))
+#else
+#define CM_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct cm_mechanism cm_mechanism;
+
+/* Mechanism given by spec as accepted by the solver after the size of graph, e.g. "pcd",
+ * "dbl -1" or "qcd 0.25 M0.5 rd R1", on the circle of graph_size vertices for profiles
+ * of agents_num agents. Returns NULL on error. */
+CM_API cm_mechanism *cm_mechanism_create(size_t graph_size, size_t agents_num, const char *spec);
+CM_API void cm_mechanism_free(cm_mechanism *mechanism);
+
+/* Probabilities of agents of each profile being chosen: count * agents_num values. */
+CM_API int cm_lottery(const cm_mechanism *mechanism, const uint32_t *profiles, size_t count, double *probabilities);
+
+/* Social costs (sums of distances to agents) of a facility at each vertex of the circle:
+ * count * graph_size values. */
+CM_API int cm_vertex_costs(const cm_mechanism *mechanism, const uint32_t *profiles, size_t count, double *costs);
+
+/* Approximation ratios of the expected social cost of the mechanism: count values. */
+CM_API int cm_approximation_ratios(const cm_mechanism *mechanism, const uint32_t *profiles, size_t count, double *ratios);
+
+/* Minimal change of expected cost of an agent over its deviations to other vertices,
+ * taken over all agents, negative if some agent gains by deviating: count values. */
+CM_API int cm_sp_penalties(const cm_mechanism *mechanism, const uint32_t *profiles, size_t count, double *penalties);
+
+/* Description of the last error of the calling thread. */
+CM_API const char *cm_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,48 @@
+/* Checks of the C interface of libcycle.so (see libcycle.h), run by auto_test. Prints
+ * failed checks and exits with 1 if there are any. */
+#include "libcycle.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+static int failures = 0;
+
+static void expect(int condition, const char *what) {
+    if (!condition) {
+        printf("failed: %s\n", what);
+        ++failures;
+    }
+}
+
+int main(void) {
+    expect(cm_mechanism_create(8, 3, "nonexistent") == NULL, "unknown mechanism is rejected");
+    expect(strlen(cm_last_error()) > 0, "rejected mechanism sets error");
+
+    cm_mechanism *m = cm_mechanism_create(8, 3, "pcd");
+    expect(m != NULL, "pcd is created");
+    if (!m) return 1;
+
+    /* the second and third profiles are rotations of the first one */
+    const uint32_t profiles[] = {0, 2, 5, 0, 3, 6, 0, 3, 5};
+    double probabilities[9], penalties[3], ratios[3];
+    expect(cm_lottery(m, profiles, 3, probabilities) == 0, "lottery is evaluated");
+    for (int i = 0; i < 3; ++i) {
+        const double *ps = probabilities + 3 * i;
+        expect(fabs(ps[0] + ps[1] + ps[2] - 1) < 1e-9, "probabilities sum to 1");
+    }
+    expect(cm_sp_penalties(m, profiles, 3, penalties) == 0, "penalties are evaluated");
+    expect(fabs(penalties[1] - penalties[0]) < 1e-9 && fabs(penalties[2] - penalties[0]) < 1e-9,
+        "penalties do not depend on rotations");
+    expect(cm_approximation_ratios(m, profiles, 3, ratios) == 0 && ratios[0] >= 1 - 1e-9, "ratio is at least 1");
+
+    const uint32_t unsorted[] = {5, 2, 0};
+    expect(cm_sp_penalties(m, unsorted, 1, penalties) == -1, "unsorted profile is rejected");
+    const uint32_t outside[] = {0, 2, 8};
+    expect(cm_lottery(m, outside, 1, probabilities) == -1, "vertex outside of graph is rejected");
+    expect(cm_lottery(NULL, profiles, 1, probabilities) == -1, "missing mechanism is rejected");
+    expect(strlen(cm_last_error()) > 0, "missing mechanism sets error");
+
+    cm_mechanism_free(m);
+    return failures != 0;
+}
@@ -3,11 +3,31 @@
 #include <string>
 #include <functional>
 #include <memory>
+#include <chrono>
+#include <sstream>
+#include <stdexcept>
+#include <iterator>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <map>
+#include <queue>
+#include <condition_variable>
+#include <filesystem>
+#include <cerrno>
+#include <cstring>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "lib.h"
 
-using std::cout;
 using std::identity;
 using std::make_unique, std::unique_ptr;
+using std::make_shared, std::shared_ptr;
 using std::max;
 using std::setprecision;
 using std::stoul, std::stod, std::stoi;
@@ -15,11 +35,306 @@ using std::string;
 using std::move;
 
 [[noreturn]] void fail(string reason) {
-    cout << reason << "\n";
-    exit(1);
+    throw std::runtime_error(reason);
 }
 
-int main(int argc, const char **argv) {
+// Heap allocations are counted per thread by heapAllocations of lib.h, so that allocations
+// in hot loops can be spotted. The number per processed sequence is printed with all output
+// and by builds with stage statistics (see StageStats); perf_test reads it from RUN_STATS.
+[[gnu::noinline]] void *operator new(size_t n) {
+    ++heapAllocations;
+    if (void *p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+[[gnu::noinline]] void operator delete(void *p) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+struct Run {
+    int exitCode = 0;
+    Result result{};
+    double seconds = 0;
+    size_t allocations = 0;
+};
+
+// Key of a file read by a run: its path and modification time, so that edited files are read again.
+string fileKey(const string &path) {
+    std::error_code error;
+    auto time = std::filesystem::last_write_time(path, error);
+    return path + '@' + (error ? string() : std::to_string(time.time_since_epoch().count()));
+}
+
+// Graphs and lotteries built by jobs of server mode, keyed by the parameters they are built
+// from, so that later jobs with the same parameters reuse them. Shared by threads running jobs.
+// At most maxEntries of each kind are kept, the least recently used are dropped first, and
+// so are those built from earlier versions of edited files.
+class SolverCache {
+    static constexpr size_t maxEntries = 64;
+    template<typename V>
+    struct Entry {
+        V value;
+        size_t used;
+    };
+    std::mutex mutex;
+    size_t uses = 0;
+    std::map<string, Entry<shared_ptr<const Graph>>> graphs;
+    // lotteries with numbers of arguments they are parsed from
+    std::map<string, Entry<std::pair<lottery, size_t>>> lotteries;
+    // key without modification times of files (see fileKey), shared by entries built from
+    // versions of the same files
+    static string stem(const string &key) {
+        string res;
+        for (size_t from = 0; from <= key.size();) {
+            size_t to = std::min(key.find(' ', from), key.size());
+            size_t at = key.rfind('@', to - 1);
+            bool time = at != string::npos && at >= from
+                && std::all_of(key.begin() + at + 1, key.begin() + to, [](char c) EXPR(isdigit(c) || c == '-'));
+            res.append(key, from, (time ? at : to) - from);
+            if (to < key.size()) res += ' ';
+            from = to + 1;
+        }
+        return res;
+    }
+    template<typename V, typename F>
+    V find(std::map<string, Entry<V>> &values, const string &key, F build) {
+        {
+            std::lock_guard lock(mutex);
+            if (auto it = values.find(key); it != values.end()) {
+                it->second.used = ++uses;
+                return it->second.value;
+            }
+        }
+        // built without the lock, a job building the same value meanwhile keeps the first one
+        V value = build();
+        std::lock_guard lock(mutex);
+        auto [it, inserted] = values.try_emplace(key, Entry<V>{std::move(value), 0});
+        it->second.used = ++uses;
+        if (inserted) {
+            const string keyStem = stem(key);
+            std::erase_if(values, [&](const auto &entry) EXPR(entry.first != key && stem(entry.first) == keyStem));
+            if (values.size() > maxEntries) {
+                values.erase(rn::min_element(values, {}, [](const auto &entry) EXPR(entry.second.used)));
+            }
+        }
+        return it->second.value;
+    }
+public:
+    template<typename F>
+    shared_ptr<const Graph> getGraph(const string &key, F build) EXPR(find(graphs, key, build))
+    template<typename F>
+    std::pair<lottery, size_t> getLottery(const string &key, F build) EXPR(find(lotteries, key, build))
+};
+
+// Identifies the build in keys of cached results and tables, so that a rebuilt solver does not
+// reuse what an older one stored. The Makefile passes a hash of the sources, so that rebuilds
+// of the same sources share the cache; other builds fall back to their build time.
+#ifndef SOLVER_VERSION
+#define SOLVER_VERSION __DATE__ " " __TIME__
+#endif
+
+// Arguments from [from, to) separated by single spaces. Files named by them (vertex positions
+// and custom lotteries) are replaced by their keys, so that edited files are read again.
+string normalizedArgs(const char **from, const char **to) {
+    string res;
+    for (bool path = false; from != to; ++from) {
+        string arg = *from;
+        if (path) arg = fileKey(arg);
+        else if (arg.starts_with('O')) arg.replace(1, string::npos, fileKey(arg.substr(1)));
+        path = arg.starts_with("custom");
+        if (!res.empty()) res += ' ';
+        res += arg;
+    }
+    return res;
+}
+
+// 64-bit FNV-1a hash of key in hexadecimal, naming the file key is stored in.
+string hashKey(const string &key) {
+    uint64_t res = 0xcbf29ce484222325;
+    for (unsigned char c : key) res = (res ^ c) * 0x100000001b3;
+    std::ostringstream os;
+    os << std::hex << std::setw(16) << std::setfill('0') << res;
+    return os.str();
+}
+
+// Lottery probabilities of sorted profiles of agentsNum vertices, memoized in a file mapped to
+// memory, so that runs of the same mechanism (also concurrent ones) share the work. Rows are
+// indexed by the first vertex and the rank of a profile (see SeqRanker). A row is filled once
+// its profile is first evaluated, a state byte tells whether it is empty, being written or ready.
+class LotteryTable {
+    static constexpr size_t headerSize = 4096;
+    // larger tables are not kept, as evaluating lotteries is cheaper than faulting their pages
+    static constexpr size_t maxBytes = size_t(1) << 30;
+    enum State : unsigned char { empty, writing, ready };
+    SeqRanker ranker;
+    size_t agentsNum, total;
+    size_t mapSize = 0;
+    char *map = nullptr;
+    unsigned char *states;
+    real *values;
+public:
+    // throws if the table cannot be kept in file at path
+    LotteryTable(const string &path, const string &key, size_t graphSize, size_t agentsNum)
+    : ranker(graphSize, agentsNum), agentsNum(agentsNum), total(ranker.total()) {
+        if (key.size() >= headerSize || total > maxBytes / graphSize) fail("lottery table too large");
+        size_t rows = graphSize * total;
+        size_t valuesOffset = (headerSize + rows + alignof(real) - 1) / alignof(real) * alignof(real);
+        if (rows * agentsNum > (maxBytes - valuesOffset) / sizeof(real)) fail("lottery table too large");
+        mapSize = valuesOffset + rows * agentsNum * sizeof(real);
+        int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) fail("cannot open lottery table " + path);
+        struct stat st;
+        // a new file is extended with zeros, so all rows are empty
+        bool ok = fstat(fd, &st) == 0 && (st.st_size == off_t(mapSize) || (st.st_size == 0 && ftruncate(fd, mapSize) == 0));
+        if (ok) {
+            void *m = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (m != MAP_FAILED) map = static_cast<char *>(m);
+        }
+        close(fd);
+        if (!map) fail("cannot map lottery table " + path);
+        // the key is written by whichever run creates the file first, others check it
+        if (!map[0]) memcpy(map, key.c_str(), key.size() + 1);
+        else if (strncmp(map, key.c_str(), headerSize) != 0) fail("lottery table " + path + " belongs to another key");
+        states = reinterpret_cast<unsigned char *>(map + headerSize);
+        values = reinterpret_cast<real *>(map + valuesOffset);
+    }
+    LotteryTable(const LotteryTable &) = delete;
+    ~LotteryTable() { if (map) munmap(map, mapSize); }
+    // probabilities of lot for profile p, from the table if they are there
+    l<real> get(const lottery &lot, const Profile &p) {
+        const l<size_t> &as = p.agents();
+        if (as.size() != agentsNum) return lot(p);
+        size_t row = as[0] * total + ranker.rank(as);
+        std::atomic_ref<unsigned char> state(states[row]);
+        real *rowValues = values + row * agentsNum;
+        if (state.load(std::memory_order_acquire) == ready) {
+            l<real> res = VectorPool<real>::take();
+            res.assign(rowValues, rowValues + agentsNum);
+            return res;
+        }
+        l<real> res = lot(p);
+        // a row being written by another thread is not waited for
+        unsigned char expected = empty;
+        if (res.size() == agentsNum && state.compare_exchange_strong(expected, writing, std::memory_order_acquire)) {
+            rn::copy(res, rowValues);
+            state.store(ready, std::memory_order_release);
+        }
+        return res;
+    }
+};
+
+// Copies everything printed to cout and cerr while it is alive, forwarding it as usual.
+class OutputCopy {
+    class Buf : public std::streambuf {
+    protected:
+        int overflow(int c) override {
+            if (c != EOF) text += char(c);
+            return inner->sputc(c);
+        }
+        std::streamsize xsputn(const char *s, std::streamsize n) override {
+            text.append(s, n);
+            return inner->sputn(s, n);
+        }
+        int sync() override EXPR(inner->pubsync())
+    public:
+        std::streambuf *inner;
+        string text;
+        Buf(std::streambuf *inner) : inner(inner) {}
+    };
+    Buf out, err;
+public:
+    OutputCopy() : out(cout.rdbuf()), err(cerr.rdbuf()) {
+        cout.rdbuf(&out);
+        cerr.rdbuf(&err);
+    }
+    OutputCopy(const OutputCopy &) = delete;
+    ~OutputCopy() {
+        cout.rdbuf(out.inner);
+        cerr.rdbuf(err.inner);
+    }
+    const string &outText() const EXPR(out.text)
+    const string &errText() const EXPR(err.text)
+};
+
+// Cache in directory named by RESULT_CACHE environment variable (disabled if it is not set)
+// of outputs of runs and of lottery tables, in files named by hashes of their keys, which
+// start with the version of the solver. Runs with the same normalized arguments print the
+// stored output instead of solving again, and runs of the same mechanism share its lottery
+// table (see LotteryTable) whatever their tasks are. Failures to use it are silent.
+class ResultCache {
+    std::filesystem::path dir;
+    std::filesystem::path file(const string &key, const char *extension) const EXPR(dir / (hashKey(key) + extension))
+public:
+    ResultCache(std::filesystem::path dir) : dir(std::move(dir)) {}
+    static std::optional<ResultCache> fromEnvironment() {
+        const char *dir = std::getenv("RESULT_CACHE");
+        if (!dir || !*dir) return std::nullopt;
+        std::error_code error;
+        std::filesystem::create_directories(dir, error);
+        return ResultCache(dir);
+    }
+    // run stored under key with its output printed again, if there is one
+    std::optional<Run> replay(const string &key) const {
+        std::ifstream in(file(key, ".run"), std::ios::binary);
+        string storedKey, word;
+        if (!std::getline(in, storedKey) || storedKey != key) return std::nullopt;
+        Run run;
+        string answer, seconds;
+        if (!(in >> word >> run.exitCode >> answer >> seconds >> run.allocations) || word != "run") return std::nullopt;
+        run.seconds = std::strtod(seconds.c_str(), nullptr);
+        string out, err;
+        // output is stored raw, each preceded by its length
+        auto readText = [&](const char *name, string &text) {
+            size_t size;
+            if (!(in >> word >> size) || word != name || in.get() != '\n') return false;
+            text.resize(size);
+            return bool(in.read(text.data(), size));
+        };
+        try {
+            run.result = readResult(in);
+        } catch (const std::runtime_error &) {
+            return std::nullopt;
+        }
+        run.result.answer = std::strtod(answer.c_str(), nullptr);
+        if (!readText("out", out) || !readText("err", err)) return std::nullopt;
+        cout << out;
+        // timings and allocation counts in it were measured by the stored run
+        if (!err.empty()) cerr << "cached run of " << setprecision(3) << std::defaultfloat << run.seconds
+            << " s, its diagnostics follow\n" << err;
+        return run;
+    }
+    void store(const string &key, const Run &run, const string &out, const string &err) const {
+        std::filesystem::path path = file(key, ".run");
+        // written aside and renamed, so that concurrent runs never read a partial file
+        std::ostringstream suffix;
+        suffix << '.' << getpid() << '.' << std::this_thread::get_id();
+        std::filesystem::path tmp = path;
+        tmp += suffix.str();
+        {
+            std::ofstream os(tmp, std::ios::binary);
+            os << key << "\nrun " << run.exitCode << ' ' << std::hexfloat << run.result.answer << ' ' << run.seconds
+                << std::defaultfloat << ' ' << run.allocations << '\n';
+            writeResult(os, run.result);
+            os << "out " << out.size() << '\n' << out << "err " << err.size() << '\n' << err;
+            if (!os) return;
+        }
+        std::error_code error;
+        std::filesystem::rename(tmp, path, error);
+        if (error) std::filesystem::remove(tmp, error);
+    }
+    // lot memoized in the table stored under key, or lot itself if the table cannot be kept
+    lottery tabulated(const string &key, size_t graphSize, size_t agentsNum, lottery lot) const {
+        shared_ptr<LotteryTable> table;
+        try {
+            table = make_shared<LotteryTable>(file(key, ".lottery").string(), key, graphSize, agentsNum);
+        } catch (const std::exception &) {
+            return lot;
+        }
+        return [table, lot](const Profile &p) EXPR(table->get(lot, p));
+    }
+};
+
+// Parses null terminated argv (starting with program name) and performs requested task.
+// Graphs and lotteries are taken from cache if it is given.
+Run solve(const char **argv, SolverCache *cache = nullptr) {
     auto consume = [&argv](const char *arg) {
         if (!*argv) fail(string{"expected parameter: "} + arg);
         return *argv++;
@@ -27,11 +342,26 @@ int main(int argc, const char **argv) {
     auto flag = [&argv](const char *flag, char symbol, const char *def = nullptr)
         EXPR((*argv && **argv == symbol) ? (*argv++)+1 : def);
     consume("program name");
+    const char **args = argv, **argsEnd = argv;
+    while (*argsEnd) ++argsEnd;
+    if (*argv && string(*argv) == "merge") {
+        ++argv;
+        l<Shard> shards;
+        while (*argv) shards.push_back(readShard(*argv++));
+        Shard merged = mergeShards(shards);
+        printShard(merged);
+        cout.flush();
+        return {0, merged.result};
+    }
     size_t agentsNum = stoul(flag("num of agents", 'N', "3"));
     bool rdFlag = flag("rd ratio", 'B');
     bool scFlag = flag("approximation ratio", 'A');
     bool complexityFlag = flag("complexity only", 'C');
-    flag("check", 'D');
+    // D<size> checks group strategyproofness for coalitions of up to size agents (see coalitionCheck)
+    const char *checkVal = flag("check", 'D');
+    bool checkFlag = checkVal;
+    size_t coalitionSize = checkVal && *checkVal ? stoul(checkVal) : 0;
+    if (checkVal && *checkVal && coalitionSize == 0) fail("coalitions need at least one agent");
     bool avgFlag = flag("calculate average", 'E');
     bool pcdBoundFlag = flag("pcd bound", 'F');
     bool numOfPointsFlag = flag("num of points", 'P');
@@ -40,97 +370,615 @@ int main(int argc, const char **argv) {
     bool reversedLot = flag("reverse lottery", 'R');
     bool reverseOptimization = flag("reverse optimization", 'I');
     size_t boringOptimization = stoul(flag("boring optimization", 'J', "0"));
-    bool stdinGenerator = flag("stdin generator", 'G');
-    size_t graphSize = stoul(consume("size of graph"));
-    const Graph &graph = Circle(graphSize);
-    auto parseLottery = [&]() -> lottery {
-        string method = consume("method");
-        if (method == "rd") return rdLottery;
-        else if (method == "pcd") return distantBasedLottery(graphSize, uniformRank);
-        else if (method == "pcd2") return oppositionBasedLottery<false>(graphSize, identity());
-        else if (method == "pcd3") {
-            l<real> weight(agentsNum, .0);
-            weight[(agentsNum - 1) / 2] = 1;
-            return gapBasedLottery(graphSize, weight);
-        }
-        else if (method == "r3pcd") {
-            l<real> weight(agentsNum, .0);
-            for(size_t i = 0; i < agentsNum; i++) weight[i] = (1+2*i)*agentsNum-2/3.-2*i*(i+1);
-            return gapBasedLottery(graphSize, weight);
-        }
-        else if (method == "dbl") return distantBasedLottery(graphSize, powerRank(stod(consume("exponent"))));
-        else if (method == "sqcd") return distantBasedLottery(graphSize, circleRank);
-        else if (method == "qcd") {
-            real bound = stod(consume("exponent"));
-            return oppositionBasedLottery(graphSize, [bound](real r) EXPR(max(r * r, bound * bound)));
-        }
-        else if (method == "custom0") return customLottery(graphSize, consume("path"), 0);
-        else if (method == "custom1") return customLottery(graphSize, consume("path"), 1);
-        else if (method == "opt") return optLottery(graph);
-        fail("unrecognised method: " + method);
+    // G reads sequences from stdin, G1 enumerates them in Gray code order (see gray_seqs)
+    const char *generatorVal = flag("generator", 'G');
+    bool stdinGenerator = generatorVal && !*generatorVal;
+    bool grayOrder = generatorVal && string(generatorVal) == "1";
+    if (generatorVal && !stdinGenerator && !grayOrder) fail(string{"unrecognised generator: "} + generatorVal);
+    const char *certifiedVal = flag("certified", 'X');
+    size_t resolutionLevels = stoul(flag("multi-resolution levels", 'W', "0"));
+    size_t resolutionTopK = stoul(flag("multi-resolution candidates", 'K', "16"));
+    size_t threads = stoul(flag("threads", 'T', "1"));
+    size_t samples = stoul(flag("uniform samples", 'U', "0"));
+    size_t seed = stoul(flag("random seed", 'Q', "0"));
+    const char *rankRange = flag("rank range", 'H');
+    size_t restarts = stoul(flag("local search restarts", 'Y', "0"));
+    size_t steps = stoul(flag("local search steps", 'Z', "1000"));
+    // O<path> replaces uniform circle by vertices at positions read from file; the size
+    // of the graph follows from it. Such circles are not symmetric under rotations, so all
+    // profiles and deviations of every agent are analysed, as on the path.
+    const char *positionsPath = flag("vertex positions", 'O');
+    // L<vertex> analyses the path obtained by cutting the circle at given vertex (0 by default),
+    // over all profiles and deviations of every agent, as the path is not anchored
+    const char *pathSplit = flag("path graph", 'L');
+    // runs reading stdin cannot be repeated, so they are not cached; stored runs are replayed
+    // before any graph or lottery is built
+    const std::optional<ResultCache> resultCache = stdinGenerator ? std::nullopt : ResultCache::fromEnvironment();
+    const string runKey = string(SOLVER_VERSION) + " | " + normalizedArgs(args, argsEnd);
+    if (resultCache) {
+        if (std::optional<Run> cached = resultCache->replay(runKey)) {
+            cout.flush();
+            cerr.flush();
+            return *cached;
+        }
+    }
+    l<real> positions;
+    shared_ptr<const Graph> graphPtr;
+    // parameters the graph is built from, also identifying it in keys of cached lotteries
+    string graphKey;
+    auto buildGraph = [&](const string &key, auto build) -> shared_ptr<const Graph> {
+        graphKey = key;
+        return cache ? cache->getGraph(key, build) : build();
     };
-    lottery lot = parseLottery();
-
-    while(const char *val = flag("mix lottery", 'M')) lot = mixedLottery(graphSize, stod(val), parseLottery(), lot);
-
-    while(const char *val = flag("randomized lottery", 'R')) {
-        size_t t = stoul(val);
-        if (t == 0) lot = randomizedLottery(lot);
-        else if (t == 1) lot = randomizedLottery2(lot);
-        else fail("unrecognised randomization type: " + string(val));
+    if (positionsPath) {
+        graphPtr = buildGraph("positions " + fileKey(positionsPath), [&] EXPR(make_shared<CustomCircle>(loadPositions(positionsPath))));
+        positions = static_cast<const CustomCircle &>(*graphPtr).positions();
+    }
+    else if (pathSplit) {
+        size_t size = stoul(consume("size of graph"));
+        size_t splitVertex = *pathSplit ? stoul(pathSplit) : 0;
+        if (splitVertex >= size) fail("split vertex out of graph");
+        graphPtr = buildGraph("path " + std::to_string(size) + ' ' + std::to_string(splitVertex),
+            [&] EXPR(make_shared<SplitCircle>(Circle(size).split(splitVertex))));
     }
+    else {
+        size_t size = stoul(consume("size of graph"));
+        graphPtr = buildGraph("circle " + std::to_string(size), [&] EXPR(make_shared<Circle>(size)));
+    }
+    const Graph &graph = *graphPtr;
+    size_t graphSize = graph.size;
+    // profiles of other graphs are enumerated whole, see Graph::anchored
+    const bool anchored = graph.anchored();
+    auto makeLottery = [&]<typename T>(T) EXPR(parseMethod<T>(argv, {graphSize, agentsNum, positions, graph}));
+    auto parseLottery = [&]<typename T>(T tag) -> lotteryOf<T> {
+        if constexpr (std::is_same_v<T, real>) {
+            if (cache && *argv) {
+                // a method takes at most one parameter, so it is determined by two arguments
+                string method = argv[0], parameter = argv[1] ? argv[1] : "";
+                if (method.starts_with("custom")) parameter = fileKey(parameter);
+                string key = graphKey + ' ' + std::to_string(graphSize) + ' ' + std::to_string(agentsNum)
+                    + ' ' + method + ' ' + parameter;
+                const char **methodArgs = argv;
+                auto [lot, argsNum] = cache->getLottery(key, [&] {
+                    lottery built = makeLottery(tag);
+                    return std::pair{built, size_t(argv - methodArgs)};
+                });
+                argv = methodArgs + argsNum;
+                return lot;
+            }
+        }
+        return makeLottery(tag);
+    };
+    auto buildLottery = [&]<typename T>(T tag) -> lotteryOf<T> {
+        lotteryOf<T> lot = parseMechanism<T>(argv, graphSize, [&] EXPR(parseLottery(tag)));
+        if (reversedLot) lot = reversedLottery(graphSize, lot);
+        return lot;
+    };
+    if (positionsPath && (reversedLot || pathSplit)) fail("vertex positions support neither reversed lottery nor path graph");
+    // sampling, local search, other generators and mirror optimizations assume an anchored uniform circle
+    if (!anchored && (certifiedVal || resolutionLevels || reverseOptimization || boringOptimization || generatorVal || samples || restarts))
+        fail("path graph and vertex positions support only exhaustive enumeration of all sequences");
+    // with cache, lotteries of randomized mechanisms (R<type>, evaluating the inner mechanism
+    // on every triple of agents) are memoized in tables shared by runs of the same mechanism;
+    // other lotteries are cheaper to evaluate again than to look up
+    auto tabulated = [&](lottery lot, const char **mechanismArgs) {
+        bool randomized = false;
+        for (const char **arg = mechanismArgs; arg != argv; ++arg) {
+            if (string(*arg).starts_with("custom")) ++arg;
+            else randomized |= **arg == 'R';
+        }
+        if (!resultCache || !randomized) return lot;
+        string key = string(SOLVER_VERSION) + " | " + graphKey + ' ' + std::to_string(graphSize) + ' '
+            + std::to_string(agentsNum) + (reversedLot ? " R " : " ") + normalizedArgs(mechanismArgs, argv);
+        return resultCache->tabulated(key, graphSize, agentsNum, lot);
+    };
+    const char **lotteryArgs = argv;
+    lottery lot = tabulated(buildLottery(real()), lotteryArgs);
+    // further mechanisms separated by "," are evaluated in the same pass
+    auto joinArgs = [](const char **from, const char **to) {
+        string res;
+        for (; from != to; ++from) {
+            if (!res.empty()) res += ' ';
+            res += *from;
+        }
+        return res;
+    };
+    l<lottery> lotteries{lot};
+    l<string> mechanismNames{joinArgs(lotteryArgs, argv)};
+    while (*argv && string(*argv) == ",") {
+        const char **mechanismArgs = ++argv;
+        lotteries.push_back(tabulated(buildLottery(real()), mechanismArgs));
+        mechanismNames.push_back(joinArgs(mechanismArgs, argv));
+    }
+    const bool multipleLotteries = lotteries.size() > 1;
+    // parses lottery arguments again, with different number type or for different graph size
+    auto reparseLottery = [&]<typename T>(T tag, size_t size) -> lotteryOf<T> {
+        const char **restArgs = std::exchange(argv, lotteryArgs);
+        size_t restSize = std::exchange(graphSize, size);
+        lotteryOf<T> res = buildLottery(tag);
+        argv = restArgs;
+        graphSize = restSize;
+        return res;
+    };
+    exactLottery exactLot;
+    if (certifiedVal) exactLot = reparseLottery(Rational(), graphSize);
 
-    if (reversedLot) lot = reversedLottery(graphSize, lot);
+    // F1 balanced, F2 dominant, F3 agent 0 optimal, F4<threshold>/<span> centrality at least
+    // threshold, F5<threshold> sparse; leading '-' negates a filter
+    l<ProfilePredicate> predicates;
+    // balance and dominance of plain increasing sequences are enforced during generation
+    const bool canPrune = !stdinGenerator && !grayOrder && !boringOptimization && !reverseOptimization && !rankRange && anchored;
+    bool pruneBalanced = false, pruneDominant = false;
+    l<ProfilePredicate> generatorPredicates;
+    while (const char *val = flag("filter", 'F'))
+    {
+        string spec = val;
+        bool negate = spec.starts_with('-');
+        string args = spec.substr(negate + 1);
+        char kind = spec.size() > size_t(negate) ? spec[negate] : 0;
+        ProfilePredicate pred;
+        if (kind == '1') pred = balancedPredicate();
+        else if (kind == '2') pred = dominantPredicate();
+        else if (kind == '3') pred = zeroOptPredicate();
+        else if (kind == '4') {
+            size_t sep = args.find('/');
+            if (sep == string::npos) fail("expected centrality filter F4<threshold>/<span>: " + spec);
+            pred = centralityPredicate(stod(args.substr(0, sep)), stoul(args.substr(sep + 1)));
+        }
+        else if (kind == '5') pred = sparsePredicate(stod(args));
+        else fail("unrecognised filter: " + spec);
+        if (negate) pred = negated(pred);
+        predicates.push_back(pred);
+        if (canPrune && !negate && kind == '1') pruneBalanced = true;
+        else if (canPrune && !negate && kind == '2') pruneDominant = true;
+        else generatorPredicates.push_back(pred);
+    }
 
     unique_ptr<seqs> generator;
-    if (stdinGenerator) generator = make_unique<stdin_seqs>(0, graphSize, agentsNum);
+    // in server mode stdin carries jobs
+    if (stdinGenerator && cache) fail("stdin generator is not available in server mode");
+    if (!anchored) generator = make_unique<path_seqs>(0, graphSize, agentsNum);
+    else if (stdinGenerator) generator = make_unique<stdin_seqs>(0, graphSize, agentsNum);
     else if (boringOptimization) generator = make_unique<increasing_boring_asymmetric_seqs<>>(0, graphSize, agentsNum, boringOptimization);
     else if (reverseOptimization) generator = make_unique<increasing_asymmetric_seqs>(0, graphSize, agentsNum);
+    else if (grayOrder) {
+        if (boringOptimization || reverseOptimization || rankRange || samples || restarts || resolutionLevels || certifiedVal)
+            fail("Gray code order supports only plain exhaustive enumeration");
+        if (multipleLotteries || rdFlag || complexityFlag || checkFlag + (scFlag || avgFlag || numOfPointsFlag || pcdBoundFlag) > 1)
+            fail("Gray code order supports only a single check or approximation ratio");
+        generator = make_unique<gray_seqs>(0, graphSize, agentsNum);
+    }
+    else if (pruneBalanced || pruneDominant) generator = make_unique<constrained_seqs>(0, graphSize, agentsNum, pruneBalanced, pruneDominant);
     else generator = make_unique<increasing_seqs>(0, graphSize, agentsNum);
+    // H<begin>-<end> processes only sequences with ranks from [begin, end), end defaults to all;
+    // H<i>/<k> processes the i-th of k shards of about equal numbers of processed sequences
+    // (see shardBoundaries) and prints its partial result instead, which "merge <files>"
+    // combines into output of the whole run
+    bool sharded = false;
+    if (rankRange) {
+        if (stdinGenerator || samples || resolutionLevels) fail("rank range requires exhaustive enumeration");
+        string range = rankRange;
+        size_t beginRank, endRank;
+        if (size_t slash = range.find('/'); slash != string::npos) {
+            size_t index = stoul(range.substr(0, slash)), shards = stoul(range.substr(slash + 1));
+            if (index >= shards) fail("shard index out of range: " + range);
+            const l<size_t> boundaries = shardBoundaries(*generator, graph, generatorPredicates, shards);
+            beginRank = boundaries[index];
+            endRank = boundaries[index + 1];
+            sharded = true;
+        }
+        else {
+            size_t sep = range.find('-');
+            beginRank = stoul(range.substr(0, sep));
+            endRank = sep == string::npos ? numeric_limits<size_t>::max() : stoul(range.substr(sep + 1));
+        }
+        generator = make_unique<RankRange>(std::move(generator), beginRank, endRank);
+    }
 
-    while (const char *val = flag("filter", 'F'))
-    {
-        if (val[0] == '1') generator = make_unique<FilterUnbalanced>(std::move(generator), graph);
-        else if (val[0] == '2') generator = make_unique<FilterDominant>(std::move(generator), graph);
-        else fail("unrecognised filter: " + string(val));
+    const FilterPipeline *pipeline = nullptr;
+    if (!generatorPredicates.empty()) {
+        auto filtered = make_unique<FilterPipeline>(std::move(generator), graph, generatorPredicates);
+        pipeline = filtered.get();
+        generator = std::move(filtered);
     }
+    // in sampling mode every block of samples is drawn by its own generator
+    auto makeSampler = [&](size_t block, size_t num) -> unique_ptr<seqs> {
+        auto gen = make_unique<random_seqs>(0, graphSize, agentsNum, num, std::seed_seq{seed, block},
+            boringOptimization, reverseOptimization || boringOptimization);
+        if (predicates.empty()) return gen;
+        return make_unique<FilterPipeline>(std::move(gen), graph, predicates);
+    };
 
     if(const char *val = flag("strategyproofisation", 'P')) {
+        if (multipleLotteries) fail("strategyproofisation supports a single mechanism");
+        if (certifiedVal) fail("no exact counterpart of strategyproofisation");
+        if (resolutionLevels) fail("multi-resolution search does not support strategyproofisation");
+        if (!anchored) fail("path graph and vertex positions do not support strategyproofisation");
         size_t gen_type = val[0] != 0 ? stoul(val) : 0;
         unique_ptr<seqs> gen;
         if (gen_type == 1) gen = make_unique<increasing_boring_asymmetric_seqs<>>(0, graphSize, agentsNum, boringOptimization);
         else if (gen_type == 0) gen = make_unique<increasing_asymmetric_seqs>(0, graphSize, agentsNum);
         else gen = make_unique<increasing_seqs>(0, graphSize, agentsNum);
-        lot = mixedLottery(graphSize, rdRatio(lot, *gen, Circle(graphSize), Verbosity::none), rdLottery, lot);
+        lot = mixedLottery(graphSize, rdRatio(lot, *gen, graph, Verbosity::none).answer, rdLottery<>, lot);
     }
 
     int exitCodeOnLimit = stoi(flag("exit code on limit", 'E', "0"));
 
     if (const char *val = flag("limit", 'L')) {
         double limit = stod(val);
-        double estimatedSize = generator->approxSize();
+        double estimatedSize = samples ? samples : restarts ? restarts * (steps + 1.) : generator->approxSize();
         if (limit > 0 && estimatedSize > limit) {
             if (verbosity == Verbosity::answer) cout << "SEQS: " << setprecision(2) << scientific<< estimatedSize;
             else if (verbosity >= Verbosity::summary) {
                 cout << "Estimated number of sequences: " << setprecision(2) << scientific << estimatedSize << '\n';
             }
-            return exitCodeOnLimit;
+            return {exitCodeOnLimit};
         }
     }
 
     // check that there are no arguments left
     if (*argv) fail("unconsumed arguments left");
 
-    if(rdFlag) rdRatio(lot, *generator, graph, verbosity);
-    else if (pcdBoundFlag) score(SumQ(make_unique<PcdBound>(), make_unique<ApproxRatio>(lot)), *generator, graph, verbosity, avgFlag);
+    // a shard runs its task silently, printing only the partial result
+    Shard shard;
+    if (sharded) {
+        bool scoreTask = scFlag || avgFlag || numOfPointsFlag || pcdBoundFlag;
+        if (multipleLotteries || certifiedVal || restarts || complexityFlag || coalitionSize || checkFlag + scoreTask + rdFlag > 1
+            || verbosity == Verbosity::all)
+            fail("shards support a single check, approximation ratio or rd ratio with summary or answer verbosity");
+        shard.task = rdFlag ? Shard::Task::rd : scoreTask ? Shard::Task::score : Shard::Task::check;
+        shard.verbosity = verbosity;
+        shard.avg = avgFlag;
+        shard.distinctNum = numOfPointsFlag;
+        shard.anchored = graph.anchored();
+        verbosity = Verbosity::none;
+    }
+
+    // output of the run is stored in cache once it succeeds
+    std::optional<OutputCopy> outputCopy;
+    if (resultCache) outputCopy.emplace();
+
+    Run run;
+    auto startTime = std::chrono::steady_clock::now();
+    const size_t startAllocations = heapAllocations;
+    if (multipleLotteries && (resolutionLevels || samples || restarts || certifiedVal || pcdBoundFlag || complexityFlag))
+        fail("multiple mechanisms are supported only by check, approximation ratio and rd ratio");
+    if (coalitionSize) {
+        if (resolutionLevels || samples || restarts || certifiedVal || multipleLotteries
+            || rdFlag || scFlag || avgFlag || numOfPointsFlag || pcdBoundFlag || complexityFlag)
+            fail("coalition check supports only exhaustive enumeration of a single mechanism");
+        run.result = coalitionCheck(lot, *generator, graph, coalitionSize, threads, verbosity);
+    }
+    else if (resolutionLevels) {
+        if (!scFlag || certifiedVal || rdFlag || pcdBoundFlag || avgFlag || numOfPointsFlag || complexityFlag)
+            fail("multi-resolution search supports only approximation ratio");
+        run.result = multiResolutionScore([&](size_t size) EXPR(reparseLottery(real(), size)), *generator, graph,
+            resolutionLevels, resolutionTopK, verbosity);
+    }
+    else if (samples) {
+        if (certifiedVal || stdinGenerator || restarts || pcdBoundFlag || complexityFlag || numOfPointsFlag)
+            fail("sampling supports only check, rd ratio and approximation ratio");
+        if (rdFlag) run.result = sampleRdRatio(lot, graph, samples, threads, makeSampler, verbosity);
+        else if (scFlag || avgFlag) run.result = sampleScore(ApproxRatio(lot), graph, samples, threads, makeSampler, verbosity, avgFlag);
+        else run.result = sampleCheck(lot, graph, samples, threads, makeSampler, verbosity);
+    }
+    else if (restarts) {
+        if (certifiedVal || stdinGenerator || rankRange || boringOptimization || !predicates.empty()
+            || rdFlag || avgFlag || numOfPointsFlag || complexityFlag)
+            fail("local search supports only check and approximation ratio of unfiltered sequences");
+        if (pcdBoundFlag) run.result = localScore(SumQ(make_unique<PcdBound>(), make_unique<ApproxRatio>(lot)), graph,
+            agentsNum, restarts, steps, threads, seed, verbosity);
+        else if (scFlag) run.result = localScore(ApproxRatio(lot), graph, agentsNum, restarts, steps, threads, seed, verbosity);
+        else run.result = localCheck(lot, graph, agentsNum, restarts, steps, threads, seed, verbosity);
+    }
+    else if (certifiedVal) {
+        if (rdFlag || pcdBoundFlag || avgFlag || numOfPointsFlag || complexityFlag)
+            fail("certified mode supports only check and approximation ratio");
+        real band = *certifiedVal ? stod(certifiedVal) : EPS;
+        if (scFlag) run.result = certifiedScore(lot, exactLot, *generator, graph, verbosity, band);
+        else run.result = certifiedCheck(lot, exactLot, *generator, graph, verbosity, band);
+    }
+    else if (multipleLotteries || checkFlag + (scFlag || avgFlag || numOfPointsFlag) + rdFlag > 1) {
+        if (pcdBoundFlag || complexityFlag) fail("combined tasks do not support pcd bound and complexity");
+        bool scoreTask = scFlag || avgFlag || numOfPointsFlag;
+        // check is the default task, as in a single pass
+        run.result = combinedTasks(multipleLotteries ? lotteries : l<lottery>{lot}, mechanismNames, *generator, graph, verbosity,
+            {checkFlag || (!scoreTask && !rdFlag), scoreTask, rdFlag, avgFlag, numOfPointsFlag});
+    }
+    else if(rdFlag) run.result = rdRatio(lot, *generator, graph, verbosity);
+    else if (pcdBoundFlag) run.result = score(SumQ(make_unique<PcdBound>(), make_unique<ApproxRatio>(lot)), *generator, graph, verbosity, avgFlag);
     else if (scFlag || avgFlag || numOfPointsFlag)
-        score(ApproxRatio(lot), *generator, graph, verbosity, avgFlag, numOfPointsFlag);
-    else if(complexityFlag && verbosity >= Verbosity::answer) {
-        cout << setprecision(2) << real(generator->approxSize());
+        run.result = score(ApproxRatio(lot), *generator, graph, verbosity, avgFlag, numOfPointsFlag);
+    else if(complexityFlag) {
+        run.result.answer = generator->approxSize();
+        // counts below 2^53 are exact and printed in full; those that only bound the number
+        // of sequences (filters not counted exactly) or estimate it (partial ranges of spaces
+        // without reversed sequences) are marked so in summary
+        if (verbosity >= Verbosity::summary && !generator->exactSize())
+            cout << (generator->boundingSize() ? "at most " : "about ");
+        if (verbosity >= Verbosity::answer) {
+            if (run.result.answer < 0x1p53) cout << std::fixed << setprecision(0);
+            else cout << setprecision(2);
+            cout << run.result.answer;
+        }
         if (verbosity >= Verbosity::summary) cout << '\n';
     }
-    else check(lot, *generator, graph, verbosity);
-    std::cout.flush();
-    std::cerr.flush();
-    return 0;
+    else run.result = check(lot, *generator, graph, verbosity);
+    run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    run.allocations = heapAllocations - startAllocations;
+    if (sharded) {
+        shard.result = run.result;
+        writeShard(cout, shard);
+    }
+    if (pipeline && !samples && !complexityFlag && verbosity >= Verbosity::summary) pipeline->printStats(cerr);
+#ifdef STAGE_STATS
+    const bool allocationsShown = verbosity >= Verbosity::summary;
+#else
+    const bool allocationsShown = verbosity == Verbosity::all;
+#endif
+    if (allocationsShown && run.result.sequencesNum) {
+        cerr << "heap allocations: " << run.allocations << " (" << setprecision(3) << std::defaultfloat
+            << double(run.allocations) / run.result.sequencesNum << " per sequence)\n";
+    }
+    cout.flush();
+    cerr.flush();
+    if (resultCache) resultCache->store(runKey, run, outputCopy->outText(), outputCopy->errText());
+    return run;
+}
+
+// Splits whitespace separated arguments (as generated by the web UI) into tokens.
+l<string> splitArgs(const string &line) {
+    std::istringstream in(line);
+    return l<string>(std::istream_iterator<string>(in), std::istream_iterator<string>());
+}
+
+Run solveLine(const string &line, SolverCache *cache = nullptr) {
+    l<string> tokens = splitArgs(line);
+    l<const char *> argv{"main"};
+    for (const string &token : tokens) argv.push_back(token.c_str());
+    argv.push_back(nullptr);
+    return solve(argv.data(), cache);
+}
+
+// Stream formatting set by a previous run in the same thread must not leak into the next one.
+void resetFormatting() {
+    for (std::ostream *os : {&cout, &cerr}) {
+        os->flags(std::ios::dec | std::ios::skipws);
+        os->precision(6);
+    }
+}
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+
+// Forwards to the wrapped buffer remembering whether output ended with a newline,
+// so that a persistent module can terminate pending lines between runs.
+class LineTrackingBuf : public std::streambuf {
+    std::streambuf *inner;
+public:
+    bool atLineStart = true;
+    LineTrackingBuf(std::streambuf *inner) : inner(inner) {}
+protected:
+    int overflow(int c) override {
+        if (c != EOF) atLineStart = c == '\n';
+        return inner->sputc(c);
+    }
+    std::streamsize xsputn(const char *s, std::streamsize n) override {
+        if (n > 0) atLineStart = s[n - 1] == '\n';
+        return inner->sputn(s, n);
+    }
+    int sync() override EXPR(inner->pubsync())
+};
+
+// Structured result of the last solveArgs call: exit code, answer, number of
+// processed sequences, seconds, length of worst sequence (followed by resultProfile).
+double resultStatsBuf[5];
+l<uint32_t> resultProfileBuf;
+
+extern "C" {
+EMSCRIPTEN_KEEPALIVE int solveArgs(const char *line) {
+    static LineTrackingBuf coutBuf(cout.rdbuf()), cerrBuf(cerr.rdbuf());
+    cout.rdbuf(&coutBuf);
+    cerr.rdbuf(&cerrBuf);
+    resetFormatting();
+    Run run;
+    try {
+        run = solveLine(line);
+    } catch (const std::exception &e) {
+        cout << e.what() << '\n';
+        run.exitCode = 1;
+    }
+    if (!coutBuf.atLineStart) cout << '\n';
+    if (!cerrBuf.atLineStart) cerr << '\n';
+    cout.flush();
+    cerr.flush();
+    coutBuf.atLineStart = cerrBuf.atLineStart = true;
+    resultProfileBuf.assign(run.result.worstSeq.begin(), run.result.worstSeq.end());
+    resultStatsBuf[0] = run.exitCode;
+    resultStatsBuf[1] = run.result.answer;
+    resultStatsBuf[2] = run.result.sequencesNum;
+    resultStatsBuf[3] = run.seconds;
+    resultStatsBuf[4] = resultProfileBuf.size();
+    return run.exitCode;
+}
+EMSCRIPTEN_KEEPALIVE const double *resultStats() EXPR(resultStatsBuf)
+EMSCRIPTEN_KEEPALIVE const uint32_t *resultProfile() EXPR(resultProfileBuf.data())
+// identifies the build in keys of results cached by the web UI
+EMSCRIPTEN_KEEPALIVE const char *solverVersion() EXPR(SOLVER_VERSION)
+}
+#endif
+
+// Appends measurements of run as a JSON line to file named by RUN_STATS environment
+// variable (used by perf_test): task seconds, processed sequences and peak RSS in KiB.
+void appendRunStats(const Run &run) {
+    const char *path = std::getenv("RUN_STATS");
+    if (!path) return;
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    std::ofstream out(path, std::ios::app);
+    out << "{\"exitCode\": " << run.exitCode << ", \"seconds\": " << setprecision(6) << run.seconds
+        << ", \"sequences\": " << run.result.sequencesNum << ", \"maxRssKiB\": " << usage.ru_maxrss
+        << ", \"allocations\": " << run.allocations << "}\n";
+}
+
+// Runs submitted jobs on a fixed number of threads. Destruction waits for queued jobs.
+class JobPool {
+    std::mutex mutex;
+    std::condition_variable available;
+    std::queue<function<void()>> jobs;
+    bool closing = false;
+    l<std::jthread> threads;
+public:
+    JobPool(size_t threadsNum) {
+        for (size_t i = 0; i < threadsNum; ++i) threads.emplace_back([this] {
+            for (;;) {
+                function<void()> job;
+                {
+                    std::unique_lock lock(mutex);
+                    available.wait(lock, [this] EXPR(closing || !jobs.empty()));
+                    if (jobs.empty()) return;
+                    job = std::move(jobs.front());
+                    jobs.pop();
+                }
+                job();
+            }
+        });
+    }
+    void submit(function<void()> job) {
+        {
+            std::lock_guard lock(mutex);
+            jobs.push(std::move(job));
+        }
+        available.notify_one();
+    }
+    ~JobPool() {
+        {
+            std::lock_guard lock(mutex);
+            closing = true;
+        }
+        available.notify_all();
+    }
+};
+
+// Output of jobs read from one input. Jobs keep it alive, so that a connection is closed
+// once the last of its jobs is written.
+class Channel {
+    int fd;
+    bool socket;
+    std::mutex mutex;
+public:
+    Channel(int fd, bool socket) : fd(fd), socket(socket) {}
+    ~Channel() { if (socket) close(fd); }
+    void write(const string &data) {
+        std::lock_guard lock(mutex);
+        for (size_t done = 0; done < data.size();) {
+            // a client gone before its results are written must not terminate the server
+            ssize_t n = socket ? send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL)
+                : ::write(fd, data.data() + done, data.size() - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            done += n;
+        }
+    }
+};
+
+// Calls f with every line read from fd until its end.
+template<typename F>
+void forEachLine(int fd, F f) {
+    string pending;
+    char buf[4096];
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof buf);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        pending.append(buf, n);
+        for (size_t pos; (pos = pending.find('\n')) != string::npos; pending.erase(0, pos + 1)) f(pending.substr(0, pos));
+    }
+    if (!pending.empty()) f(pending);
+}
+
+// Appends lines of text to res, each prefixed by tag.
+void appendTagged(string &res, const string &tag, const string &text) {
+    std::istringstream in(text);
+    for (string line; std::getline(in, line);) res += tag + line + '\n';
+}
+
+// Runs job "<id> <args>" with output of the thread captured and returns it as lines
+// "<id> out <line>", "<id> err <line>" and "<id> done <exit code> <answer> <sequences> <seconds>".
+string runJob(const string &job, SolverCache &cache) {
+    std::istringstream in(job);
+    string id, args;
+    in >> id;
+    std::getline(in, args);
+    std::ostringstream out, err;
+    std::streambuf *coutBuf = cout.rdbuf(out.rdbuf()), *cerrBuf = cerr.rdbuf(err.rdbuf());
+    resetFormatting();
+    Run run;
+    try {
+        run = solveLine(args, &cache);
+    } catch (const std::exception &e) {
+        cout << e.what() << '\n';
+        run.exitCode = 1;
+    }
+    cout.rdbuf(coutBuf);
+    cerr.rdbuf(cerrBuf);
+    string res;
+    appendTagged(res, id + " out ", out.str());
+    appendTagged(res, id + " err ", err.str());
+    std::ostringstream done;
+    done << id << " done " << run.exitCode << ' ' << setprecision(17) << run.result.answer << ' '
+        << run.result.sequencesNum << ' ' << setprecision(6) << run.seconds << '\n';
+    return res + done.str();
+}
+
+// Server mode, "serve [T<threads>] [<socket path>]": reads jobs "<id> <args>" line by line,
+// args as generated by the web UI, from stdin or from every connection to a Unix socket
+// at given path. They run concurrently on a pool of threads (as many as cores by default)
+// sharing SolverCache, so that graphs, lotteries and tables are built once. Output of each
+// job is written back as a block of lines tagged with its id (see runJob) once it finishes.
+int serve(const char **argv) {
+    size_t threads = std::thread::hardware_concurrency();
+    if (*argv && **argv == 'T') threads = stoul(*argv++ + 1);
+    const char *socketPath = *argv ? *argv++ : nullptr;
+    if (*argv) fail("unconsumed arguments left");
+    SolverCache cache;
+    JobPool pool(max<size_t>(threads, 1));
+    auto serveInput = [&](int fd, shared_ptr<Channel> channel) {
+        forEachLine(fd, [&](const string &line) {
+            if (line.find_first_not_of(" \t\r") == string::npos) return;
+            pool.submit([line, channel, &cache] { channel->write(runJob(line, cache)); });
+        });
+    };
+    if (!socketPath) {
+        serveInput(STDIN_FILENO, make_shared<Channel>(STDOUT_FILENO, false));
+        return 0;
+    }
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof address.sun_path) fail(string{"socket path too long: "} + socketPath);
+    strcpy(address.sun_path, socketPath);
+    int listening = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath);
+    if (listening < 0 || bind(listening, (sockaddr *) &address, sizeof address) < 0 || listen(listening, SOMAXCONN) < 0)
+        fail(string{"cannot listen on "} + socketPath + ": " + strerror(errno));
+    for (;;) {
+        int client = accept(listening, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR) continue;
+            fail(string{"cannot accept connection: "} + strerror(errno));
+        }
+        std::thread(serveInput, client, make_shared<Channel>(client, true)).detach();
+    }
+}
+
+int main(int, const char **argv) {
+    try {
+        if (argv[1] && string(argv[1]) == "serve") return serve(argv + 2);
+        Run run = solve(argv);
+        appendRunStats(run);
+        return run.exitCode;
+    } catch (const std::exception &e) {
+        cout << e.what() << "\n";
+        return 1;
+    }
 }